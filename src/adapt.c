@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2026  Minnesota Department of Transportation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "adapt.h"
+#include "lock.h"
+
+/*
+ * Adaptive jitterbuffer latency.  Each periodic check looks at packet loss
+ * and network jitter.  Latency grows quickly when packets are lost or late,
+ * and shrinks slowly toward a floor derived from jitter after a run of clean
+ * checks.  Learned latency is remembered per camera, so it is used as the
+ * starting point the next time that camera is played.
+ */
+
+#define ADAPT_ENTRIES	(64)
+#define ADAPT_MIN_MS	(20)
+#define ADAPT_MAX_MS	(1000)
+#define ADAPT_CLEAN	(15)	/* clean checks before shrinking */
+
+struct adapt_entry {
+	char		cam_id[20];
+	uint32_t	latency;
+	gint64		used;      /* last use (monotonic us) */
+};
+
+static struct lock _lock;
+static struct adapt_entry _entries[ADAPT_ENTRIES];
+
+void adapt_init(void) {
+	lock_init(&_lock);
+	memset(_entries, 0, sizeof(_entries));
+}
+
+void adapt_destroy(void) {
+	lock_destroy(&_lock);
+}
+
+/* Find entry by camera ID, or least recently used entry */
+static struct adapt_entry *adapt_find(const char *cam_id, bool lru) {
+	struct adapt_entry *old = _entries;
+	for (int i = 0; i < ADAPT_ENTRIES; i++) {
+		struct adapt_entry *ent = _entries + i;
+		if (strcmp(ent->cam_id, cam_id) == 0)
+			return ent;
+		if (ent->used < old->used)
+			old = ent;
+	}
+	return (lru) ? old : NULL;
+}
+
+/* Remember learned latency for a camera */
+static void adapt_store(const struct adapt *ad) {
+	if (0 == ad->cam_id[0])
+		return;
+	lock_acquire(&_lock, __func__);
+	struct adapt_entry *ent = adapt_find(ad->cam_id, true);
+	snprintf(ent->cam_id, sizeof(ent->cam_id), "%s", ad->cam_id);
+	ent->latency = ad->latency;
+	ent->used = g_get_monotonic_time();
+	lock_release(&_lock, __func__);
+}
+
+/** Start adapting latency for a camera.
+ *
+ * @param latency Requested latency, used if nothing was learned yet.
+ * @return Latency to start with (ms). */
+uint32_t adapt_start(struct adapt *ad, const char *cam_id, uint32_t latency) {
+	memset(ad, 0, sizeof(struct adapt));
+	snprintf(ad->cam_id, sizeof(ad->cam_id), "%s", cam_id);
+	ad->latency = latency;
+	if (cam_id[0]) {
+		lock_acquire(&_lock, __func__);
+		struct adapt_entry *ent = adapt_find(cam_id, false);
+		if (ent) {
+			ad->latency = ent->latency;
+			ent->used = g_get_monotonic_time();
+		}
+		lock_release(&_lock, __func__);
+	}
+	return ad->latency;
+}
+
+static guint64 adapt_delta(guint64 t0, guint64 t1) {
+	return (t0 < t1) ? t1 - t0 : 0;
+}
+
+/* Get lowest latency which covers observed jitter */
+static uint32_t adapt_floor(double jitter_ms) {
+	return MAX(ADAPT_MIN_MS, (uint32_t) (jitter_ms * 3) + 10);
+}
+
+/** Update latency from periodic check.
+ *
+ * @param jitter_ms Network jitter estimate.
+ * @param lost Cumulative lost packets.
+ * @param late Cumulative late packets.
+ * @return true if latency was changed. */
+bool adapt_update(struct adapt *ad, double jitter_ms, guint64 lost,
+	guint64 late)
+{
+	uint32_t lat = ad->latency;
+	guint64 n_bad = adapt_delta(ad->lost, lost) +
+		adapt_delta(ad->late, late);
+	uint32_t fl = adapt_floor(jitter_ms);
+	if (!ad->primed)
+		n_bad = 0;
+	ad->lost = lost;
+	ad->late = late;
+	ad->primed = true;
+	if (n_bad > 0 || lat < fl) {
+		lat = MAX(MAX(lat * 3 / 2, lat + ADAPT_MIN_MS), fl);
+		lat = MIN(lat, MAX(ADAPT_MAX_MS, ad->latency));
+		ad->clean = 0;
+	} else if (++ad->clean >= ADAPT_CLEAN) {
+		lat = MAX(lat - lat / 8, fl);
+		ad->clean = 0;
+	}
+	if (lat != ad->latency) {
+		/* Read by metrics without the grid lock held here */
+		__atomic_store_n(&ad->latency, lat, __ATOMIC_RELAXED);
+		adapt_store(ad);
+		return true;
+	}
+	return false;
+}
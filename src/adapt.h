@@ -0,0 +1,24 @@
+#ifndef ADAPT_H
+#define ADAPT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <gst/gst.h>
+
+/* Adaptive jitterbuffer latency of one stream */
+struct adapt {
+	char		cam_id[20];
+	uint32_t	latency;     /* current latency (ms) */
+	guint64		lost;        /* lost packets at last update */
+	guint64		late;        /* late packets at last update */
+	uint32_t	clean;       /* updates without loss */
+	bool		primed;      /* counters have been read once */
+};
+
+void adapt_init(void);
+void adapt_destroy(void);
+uint32_t adapt_start(struct adapt *ad, const char *cam_id, uint32_t latency);
+bool adapt_update(struct adapt *ad, double jitter_ms, guint64 lost,
+	guint64 late);
+
+#endif
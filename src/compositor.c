@@ -0,0 +1,432 @@
+/*
+ * Copyright (C) 2026  Minnesota Department of Transportation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gst/video/video.h>
+#include <gst/video/videooverlay.h>
+#include <pango/pangocairo.h>
+#include "elog.h"
+#include "lock.h"
+#include "compositor.h"
+
+/*
+ * In compositor mode, every cell pipeline ends with an intervideosink.  One
+ * grid pipeline picks up the latest frame of each cell with intervideosrc,
+ * and mixes them into a single output window with a compositor element.
+ * Title bands below each cell are rendered once into one overlay composition,
+ * which is attached to (or blended into) each output frame by a pad probe.
+ *
+ * This leaves one video sink (and one presentation clock) for the whole
+ * grid, instead of one sink and X window per cell.
+ */
+
+#define TITLE_XPAD	(8)		/* pixels */
+#define TITLE_SHADE	(4)		/* shaded border around text */
+
+/* Compositor cell */
+struct comp_cell {
+	GstElement	*src;
+	GstPad		*pad;
+	int		x;
+	int		y;
+	int		height;
+	char		title[64];
+	uint32_t	font_sz;
+	GstVideoOverlayRectangle *rect;  /* rendered title (or NULL) */
+};
+
+struct compositor {
+	GstElement	*pipeline;
+	GstElement	*mixer;
+	GstElement	*fltr;
+	GstElement	*sink;
+	guint		watch;
+	struct lock	lock;            /* titles and composition */
+	GstVideoInfo	info;            /* negotiated output info */
+	bool		has_info;
+	bool		use_meta;        /* sink blends composition */
+	bool		dirty;           /* composition must be rebuilt */
+	GstVideoOverlayComposition *titles;
+	uint32_t	n_cells;
+	struct comp_cell *cells;
+};
+
+static GstElement *make_element(const char *factory_name, const char *name) {
+	GstElement *elem = gst_element_factory_make(factory_name, name);
+	if (!elem)
+		elog_err("Failed to create %s element\n", factory_name);
+	return elem;
+}
+
+static bool compositor_add(struct compositor *comp, GstElement *elem) {
+	if (elem != NULL && gst_bin_add(GST_BIN(comp->pipeline), elem))
+		return true;
+	elog_err("Element not added to compositor\n");
+	return false;
+}
+
+/** Get intervideo channel name for a cell */
+void compositor_channel(uint32_t idx, char *buf, size_t n) {
+	snprintf(buf, n, "m%u", idx);
+}
+
+static void comp_cell_init(struct comp_cell *cell, struct compositor *comp,
+	uint32_t idx)
+{
+	char channel[8];
+	compositor_channel(idx, channel, sizeof(channel));
+	cell->src = make_element("intervideosrc", NULL);
+	if (cell->src && compositor_add(comp, cell->src)) {
+		g_object_set(G_OBJECT(cell->src), "channel", channel, NULL);
+		cell->pad = gst_element_request_pad_simple(comp->mixer,
+			"sink_%u");
+		GstPad *pad = gst_element_get_static_pad(cell->src, "src");
+		if (!cell->pad || !pad ||
+		    gst_pad_link(pad, cell->pad) != GST_PAD_LINK_OK)
+			elog_err("Compositor link error: %s\n", channel);
+		if (pad)
+			gst_object_unref(pad);
+	}
+}
+
+static void comp_cell_clear(struct comp_cell *cell) {
+	if (cell->rect) {
+		gst_video_overlay_rectangle_unref(cell->rect);
+		cell->rect = NULL;
+	}
+}
+
+static PangoLayout *comp_cell_layout(const struct comp_cell *cell,
+	cairo_t *cr)
+{
+	char font[32];
+	PangoLayout *layout = pango_cairo_create_layout(cr);
+	snprintf(font, sizeof(font), "Overpass, Bold %u", cell->font_sz);
+	PangoFontDescription *desc = pango_font_description_from_string(font);
+	pango_layout_set_font_description(layout, desc);
+	pango_font_description_free(desc);
+	pango_layout_set_text(layout, cell->title, -1);
+	return layout;
+}
+
+/* Render title on a shaded background into a premultiplied ARGB buffer */
+static GstBuffer *comp_cell_render(const struct comp_cell *cell, int *w,
+	int *h)
+{
+	int tw, th;
+	cairo_surface_t *surf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+		1, 1);
+	cairo_t *cr = cairo_create(surf);
+	PangoLayout *layout = comp_cell_layout(cell, cr);
+	pango_layout_get_pixel_size(layout, &tw, &th);
+	g_object_unref(layout);
+	cairo_destroy(cr);
+	cairo_surface_destroy(surf);
+	if (tw <= 0 || th <= 0)
+		return NULL;
+	*w = tw + TITLE_SHADE * 2;
+	*h = th;
+	surf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, *w, *h);
+	cr = cairo_create(surf);
+	cairo_set_source_rgba(cr, 0, 0, 0, 0.5);
+	cairo_paint(cr);
+	cairo_set_source_rgba(cr, 1, 1, 1, 1);
+	cairo_move_to(cr, TITLE_SHADE, 0);
+	layout = comp_cell_layout(cell, cr);
+	pango_cairo_show_layout(cr, layout);
+	g_object_unref(layout);
+	cairo_destroy(cr);
+	cairo_surface_flush(surf);
+	/* ARGB32 stride is always width * 4 */
+	gsize n_bytes = (gsize) *w * *h * 4;
+	GstBuffer *buf = gst_buffer_new_memdup(
+		cairo_image_surface_get_data(surf), n_bytes);
+	cairo_surface_destroy(surf);
+	gst_buffer_add_video_meta(buf, GST_VIDEO_FRAME_FLAG_NONE,
+		GST_VIDEO_OVERLAY_COMPOSITION_FORMAT_RGB, *w, *h);
+	return buf;
+}
+
+/* Render title rectangle, at the top left of the band below the cell */
+static void comp_cell_compose(struct comp_cell *cell) {
+	int w, h;
+	if (cell->rect || !cell->title[0])
+		return;
+	GstBuffer *buf = comp_cell_render(cell, &w, &h);
+	if (buf) {
+		int x = cell->x + TITLE_XPAD - TITLE_SHADE;
+		cell->rect = gst_video_overlay_rectangle_new_raw(buf,
+			MAX(x, 0), cell->y + cell->height, w, h,
+			GST_VIDEO_OVERLAY_FORMAT_FLAG_PREMULTIPLIED_ALPHA);
+		gst_buffer_unref(buf);
+	}
+}
+
+static void compositor_clear_titles(struct compositor *comp) {
+	if (comp->titles) {
+		gst_video_overlay_composition_unref(comp->titles);
+		comp->titles = NULL;
+	}
+	comp->dirty = true;
+}
+
+/* Build one composition from all title rectangles */
+static void compositor_compose(struct compositor *comp) {
+	comp->dirty = false;
+	for (uint32_t n = 0; n < comp->n_cells; n++) {
+		struct comp_cell *cell = comp->cells + n;
+		comp_cell_compose(cell);
+		if (!cell->rect)
+			continue;
+		if (comp->titles) {
+			gst_video_overlay_composition_add_rectangle(
+				comp->titles, cell->rect);
+		} else {
+			comp->titles = gst_video_overlay_composition_new(
+				cell->rect);
+		}
+	}
+}
+
+/* Get title composition, rebuilding it if needed */
+static GstVideoOverlayComposition *compositor_get_titles(
+	struct compositor *comp, bool *use_meta)
+{
+	GstVideoOverlayComposition *titles = NULL;
+	lock_acquire(&comp->lock, __func__);
+	if (comp->dirty)
+		compositor_compose(comp);
+	if (comp->titles && comp->has_info)
+		titles = gst_video_overlay_composition_ref(comp->titles);
+	*use_meta = comp->use_meta;
+	lock_release(&comp->lock, __func__);
+	return titles;
+}
+
+/* Check if downstream can blend an overlay composition meta */
+static bool compositor_query_meta(GstPad *pad, GstCaps *caps) {
+	bool meta = false;
+	GstQuery *q = gst_query_new_allocation(caps, FALSE);
+	if (gst_pad_peer_query(pad, q)) {
+		meta = gst_query_find_allocation_meta(q,
+			GST_VIDEO_OVERLAY_COMPOSITION_META_API_TYPE, NULL);
+	}
+	gst_query_unref(q);
+	return meta;
+}
+
+static void compositor_caps(struct compositor *comp, GstPad *pad,
+	GstCaps *caps)
+{
+	bool meta = compositor_query_meta(pad, caps);
+	lock_acquire(&comp->lock, __func__);
+	comp->has_info = gst_video_info_from_caps(&comp->info, caps);
+	comp->use_meta = meta;
+	lock_release(&comp->lock, __func__);
+}
+
+static GstBuffer *compositor_blend(struct compositor *comp, GstBuffer *buf,
+	GstVideoOverlayComposition *titles)
+{
+	GstVideoFrame frame;
+	buf = gst_buffer_make_writable(buf);
+	if (gst_video_frame_map(&frame, &comp->info, buf, GST_MAP_READWRITE)) {
+		gst_video_overlay_composition_blend(titles, &frame);
+		gst_video_frame_unmap(&frame);
+	}
+	return buf;
+}
+
+static GstPadProbeReturn comp_probe_cb(GstPad *pad, GstPadProbeInfo *info,
+	gpointer user_data)
+{
+	struct compositor *comp = user_data;
+	if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+		GstEvent *ev = GST_PAD_PROBE_INFO_EVENT(info);
+		if (GST_EVENT_TYPE(ev) == GST_EVENT_CAPS) {
+			GstCaps *caps;
+			gst_event_parse_caps(ev, &caps);
+			compositor_caps(comp, pad, caps);
+		}
+	} else if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+		bool use_meta;
+		GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+		GstVideoOverlayComposition *titles = compositor_get_titles(
+			comp, &use_meta);
+		if (titles) {
+			if (use_meta) {
+				/* Only metadata is copied */
+				buf = gst_buffer_make_writable(buf);
+				gst_buffer_add_video_overlay_composition_meta(
+					buf, titles);
+			} else
+				buf = compositor_blend(comp, buf, titles);
+			GST_PAD_PROBE_INFO_DATA(info) = buf;
+			gst_video_overlay_composition_unref(titles);
+		}
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+/* Add title probe on the filter src pad */
+static void compositor_add_probe(struct compositor *comp) {
+	GstPad *pad = gst_element_get_static_pad(comp->fltr, "src");
+	if (pad) {
+		gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER |
+			GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, comp_probe_cb,
+			comp, NULL);
+		gst_object_unref(pad);
+	}
+}
+
+static gboolean comp_bus_cb(GstBus *bus, GstMessage *msg, gpointer data) {
+	GError *err;
+	gchar *debug;
+
+	switch (GST_MESSAGE_TYPE(msg)) {
+	case GST_MESSAGE_ERROR:
+		gst_message_parse_error(msg, &err, &debug);
+		elog_err("Compositor error: %s\n", err->message);
+		g_free(debug);
+		g_error_free(err);
+		break;
+	case GST_MESSAGE_WARNING:
+		gst_message_parse_warning(msg, &err, &debug);
+		elog_err("Compositor warning: %s\n", err->message);
+		g_free(debug);
+		g_error_free(err);
+		break;
+	default:
+		break;
+	}
+	return TRUE;
+}
+
+/* Link mixer, filter and sink in order */
+static void compositor_link(struct compositor *comp) {
+	if (!gst_element_link(comp->mixer, comp->fltr))
+		elog_err("Compositor filter link error\n");
+	if (!gst_element_link(comp->fltr, comp->sink))
+		elog_err("Compositor sink link error\n");
+	compositor_add_probe(comp);
+}
+
+struct compositor *compositor_create(uint32_t n_cells) {
+	struct compositor *comp = calloc(1, sizeof(struct compositor));
+	lock_init(&comp->lock);
+	comp->dirty = true;
+	comp->pipeline = gst_pipeline_new("grid");
+	GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(comp->pipeline));
+	comp->watch = gst_bus_add_watch(bus, comp_bus_cb, comp);
+	gst_object_unref(bus);
+	comp->mixer = make_element("compositor", "mix");
+	comp->fltr = make_element("capsfilter", NULL);
+	comp->sink = make_element("xvimagesink", NULL);
+	if (!compositor_add(comp, comp->mixer) ||
+	    !compositor_add(comp, comp->fltr) ||
+	    !compositor_add(comp, comp->sink))
+		return comp;
+	g_object_set(G_OBJECT(comp->mixer), "background", 1, NULL); // black
+	g_object_set(G_OBJECT(comp->sink), "sync", TRUE, NULL);
+	comp->n_cells = n_cells;
+	comp->cells = calloc(n_cells, sizeof(struct comp_cell));
+	for (uint32_t n = 0; n < n_cells; n++)
+		comp_cell_init(comp->cells + n, comp, n);
+	compositor_link(comp);
+	return comp;
+}
+
+void compositor_destroy(struct compositor *comp) {
+	gst_element_set_state(comp->pipeline, GST_STATE_NULL);
+	for (uint32_t n = 0; n < comp->n_cells; n++) {
+		if (comp->cells[n].pad)
+			gst_object_unref(comp->cells[n].pad);
+		comp_cell_clear(comp->cells + n);
+	}
+	g_source_remove(comp->watch);
+	gst_object_unref(comp->pipeline);
+	compositor_clear_titles(comp);
+	lock_destroy(&comp->lock);
+	free(comp->cells);
+	free(comp);
+}
+
+void compositor_set_handle(struct compositor *comp, guintptr handle) {
+	if (comp->sink) {
+		GstVideoOverlay *overlay = GST_VIDEO_OVERLAY(comp->sink);
+		gst_video_overlay_set_window_handle(overlay, handle);
+	}
+}
+
+/** Set output size of compositor (pixels) */
+void compositor_set_size(struct compositor *comp, int width, int height) {
+	if (comp->fltr && width > 0 && height > 0) {
+		GstCaps *caps = gst_caps_new_simple("video/x-raw",
+			"width", G_TYPE_INT, width,
+			"height", G_TYPE_INT, height,
+			NULL);
+		g_object_set(G_OBJECT(comp->fltr), "caps", caps, NULL);
+		gst_caps_unref(caps);
+	}
+}
+
+/** Set video rectangle of one cell (pixels).  The title band is placed just
+ * below the rectangle. */
+void compositor_set_cell(struct compositor *comp, uint32_t idx, int x, int y,
+	int width, int height, bool aspect)
+{
+	if (idx < comp->n_cells) {
+		struct comp_cell *cell = comp->cells + idx;
+		lock_acquire(&comp->lock, __func__);
+		if (cell->x != x || cell->y != y || cell->height != height) {
+			cell->x = x;
+			cell->y = y;
+			cell->height = height;
+			comp_cell_clear(cell);
+			compositor_clear_titles(comp);
+		}
+		lock_release(&comp->lock, __func__);
+		if (cell->pad) {
+			g_object_set(G_OBJECT(cell->pad), "xpos", x, "ypos", y,
+				"width", width, "height", height, NULL);
+			/* 1: keep-aspect-ratio */
+			g_object_set(G_OBJECT(cell->pad), "sizing-policy",
+				aspect ? 1 : 0, NULL);
+		}
+	}
+}
+
+/** Set title band text of one cell */
+void compositor_set_title(struct compositor *comp, uint32_t idx,
+	uint32_t font_sz, const char *text)
+{
+	if (idx < comp->n_cells) {
+		struct comp_cell *cell = comp->cells + idx;
+		lock_acquire(&comp->lock, __func__);
+		if (strcmp(cell->title, text) != 0 || cell->font_sz != font_sz)
+		{
+			snprintf(cell->title, sizeof(cell->title), "%s", text);
+			cell->font_sz = font_sz;
+			comp_cell_clear(cell);
+			compositor_clear_titles(comp);
+		}
+		lock_release(&comp->lock, __func__);
+	}
+}
+
+void compositor_start(struct compositor *comp) {
+	gst_element_set_state(comp->pipeline, GST_STATE_PLAYING);
+}
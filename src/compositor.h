@@ -0,0 +1,19 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <gst/gst.h>
+
+struct compositor *compositor_create(uint32_t n_cells);
+void compositor_destroy(struct compositor *comp);
+void compositor_channel(uint32_t idx, char *buf, size_t n);
+void compositor_set_handle(struct compositor *comp, guintptr handle);
+void compositor_set_size(struct compositor *comp, int width, int height);
+void compositor_set_cell(struct compositor *comp, uint32_t idx, int x, int y,
+	int width, int height, bool aspect);
+void compositor_set_title(struct compositor *comp, uint32_t idx,
+	uint32_t font_sz, const char *text);
+void compositor_start(struct compositor *comp);
+
+#endif
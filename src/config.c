@@ -18,6 +18,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include "elog.h"
 #include "nstr.h"
@@ -96,6 +97,35 @@ err:
 	return str;
 }
 
+/** Get age of a cache file (seconds), or -1 if it does not exist */
+int64_t config_cache_age(uint64_t hash) {
+	char name[PATH_LEN];
+	char path[PATH_LEN];
+	struct stat st;
+
+	if (snprintf(name, sizeof(name), CACHE, hash) < 0 ||
+	    snprintf(path, sizeof(path), PATH, name) < 0)
+		return -1;
+	if (stat(path, &st) != 0)
+		return -1;
+	time_t now = time(NULL);
+	return (now > st.st_mtime) ? now - st.st_mtime : 0;
+}
+
+/** Remove a cache file */
+void config_remove_cache(uint64_t hash) {
+	char name[PATH_LEN];
+	char path[PATH_LEN];
+
+	if (snprintf(name, sizeof(name), CACHE, hash) < 0 ||
+	    snprintf(path, sizeof(path), PATH, name) < 0)
+		return;
+	lock_acquire(&_lock, __func__);
+	if (unlink(path) != 0 && errno != ENOENT)
+		elog_err("Unlink %s: %s\n", path, strerror(errno));
+	lock_release(&_lock, __func__);
+}
+
 ssize_t config_store(const char *name, nstr_t str) {
 	char path[PATH_LEN];
 	int fd;
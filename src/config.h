@@ -7,6 +7,8 @@ void config_init(void);
 void config_destroy(void);
 nstr_t config_load(const char *name, nstr_t str);
 nstr_t config_load_cache(uint64_t hash, nstr_t str);
+int64_t config_cache_age(uint64_t hash);
+void config_remove_cache(uint64_t hash);
 ssize_t config_store(const char *name, nstr_t str);
 ssize_t config_store_cache(uint64_t hash, nstr_t str);
 void config_test();
@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2026  Minnesota Department of Transportation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "elog.h"
+#include "config.h"
+#include "idrcache.h"
+#include "lock.h"
+#include "nstr.h"
+
+/*
+ * Cache of the most recent keyframe (IDR access unit) for each camera.
+ * Buffers are byte-stream with SPS/PPS inline, so each entry can be decoded
+ * on its own.  Entries are also spilled into the config cache directory
+ * (rate limited), so they survive a restart.
+ *
+ * Disk I/O never runs on a streaming thread: spills and loads are done by one
+ * worker thread.  A load is requested when a stream starts, so the entry is
+ * usually in memory before the first keyframe is needed.  Entries older than
+ * IDR_MAX_AGE_SEC are not used, and their files are removed.
+ */
+
+#define IDR_ENTRIES	(32)
+#define IDR_MAX_BYTES	(512 * 1024)
+#define IDR_FILE_BYTES	(IDR_MAX_BYTES + 4096)
+#define IDR_SPILL_US	(300 * G_USEC_PER_SEC)
+#define IDR_MAX_AGE_SEC	(3600)
+#define IDR_MAX_AGE_US	((gint64) IDR_MAX_AGE_SEC * G_USEC_PER_SEC)
+
+struct idr_entry {
+	char		key[160];
+	GstCaps		*caps;
+	GstBuffer	*buf;
+	gint64		used;      /* last use (monotonic us) */
+	gint64		spilled;   /* last spill to disk (monotonic us) */
+	gint64		captured;  /* time of capture (monotonic us) */
+};
+
+/* Disk job for worker: spill (with caps and buffer), or load */
+struct idr_job {
+	char		key[160];
+	GstCaps		*caps;
+	GstBuffer	*buf;
+};
+
+static struct lock _lock;
+static struct idr_entry _entries[IDR_ENTRIES];
+static GThreadPool *_worker;
+
+static void idr_job_run(gpointer data, gpointer user_data);
+
+void idrcache_init(void) {
+	lock_init(&_lock);
+	memset(_entries, 0, sizeof(_entries));
+	_worker = g_thread_pool_new(idr_job_run, NULL, 1, FALSE, NULL);
+}
+
+static void idr_entry_clear(struct idr_entry *ent) {
+	if (ent->caps)
+		gst_caps_unref(ent->caps);
+	if (ent->buf)
+		gst_buffer_unref(ent->buf);
+	memset(ent, 0, sizeof(struct idr_entry));
+}
+
+void idrcache_destroy(void) {
+	/* Finish queued disk jobs */
+	g_thread_pool_free(_worker, FALSE, TRUE);
+	_worker = NULL;
+	for (int i = 0; i < IDR_ENTRIES; i++)
+		idr_entry_clear(_entries + i);
+	lock_destroy(&_lock);
+}
+
+static uint64_t idr_hash(const char *key) {
+	char buf[168];
+	nstr_t str = nstr_init(buf, sizeof(buf));
+	nstr_cat_z(&str, "idr ");
+	nstr_cat_z(&str, key);
+	return nstr_hash_fnv(str);
+}
+
+/* Find entry by key, or least recently used entry */
+static struct idr_entry *idrcache_find(const char *key, bool lru) {
+	struct idr_entry *old = _entries;
+	for (int i = 0; i < IDR_ENTRIES; i++) {
+		struct idr_entry *ent = _entries + i;
+		if (strcmp(ent->key, key) == 0)
+			return ent;
+		if (ent->used < old->used)
+			old = ent;
+	}
+	return (lru) ? old : NULL;
+}
+
+/* Write job to cache file: caps string, NUL, then access unit */
+static void idr_job_spill(struct idr_job *job) {
+	GstMapInfo info;
+	gchar *caps = gst_caps_to_string(job->caps);
+	if (gst_buffer_map(job->buf, &info, GST_MAP_READ)) {
+		uint32_t n = strlen(caps) + 1 + info.size;
+		char *buf = (n < IDR_FILE_BYTES) ? malloc(n) : NULL;
+		if (buf) {
+			nstr_t str = nstr_init(buf, n);
+			nstr_cat(&str, nstr_init_n(caps, n, strlen(caps) + 1));
+			nstr_cat(&str, nstr_init_n((char *) info.data, n,
+				info.size));
+			config_store_cache(idr_hash(job->key), str);
+			free(buf);
+		}
+		gst_buffer_unmap(job->buf, &info);
+	}
+	g_free(caps);
+}
+
+/* Store a loaded entry, unless a live one arrived meanwhile */
+static void idrcache_insert(const char *key, GstCaps *caps, GstBuffer *buf,
+	int64_t age)
+{
+	lock_acquire(&_lock, __func__);
+	if (!idrcache_find(key, false)) {
+		struct idr_entry *ent = idrcache_find(key, true);
+		gint64 now = g_get_monotonic_time();
+		idr_entry_clear(ent);
+		snprintf(ent->key, sizeof(ent->key), "%s", key);
+		ent->caps = gst_caps_ref(caps);
+		ent->buf = gst_buffer_ref(buf);
+		ent->used = now;
+		ent->spilled = now;
+		ent->captured = now - age * G_USEC_PER_SEC;
+	}
+	lock_release(&_lock, __func__);
+}
+
+/* Load job from cache file; files which are too old are removed */
+static void idr_job_load(struct idr_job *job) {
+	uint64_t hash = idr_hash(job->key);
+	int64_t age = config_cache_age(hash);
+	if (age < 0)
+		return;
+	if (age > IDR_MAX_AGE_SEC) {
+		config_remove_cache(hash);
+		return;
+	}
+	char *buf = malloc(IDR_FILE_BYTES);
+	if (!buf)
+		return;
+	nstr_t str = config_load_cache(hash, nstr_init(buf, IDR_FILE_BYTES));
+	uint32_t len = strnlen(str.buf, str.len);
+	if (len > 0 && len + 1 < str.len) {
+		GstCaps *caps = gst_caps_from_string(str.buf);
+		if (caps) {
+			uint32_t n = str.len - (len + 1);
+			GstBuffer *au = gst_buffer_new_memdup(str.buf + len + 1,
+				n);
+			idrcache_insert(job->key, caps, au, age);
+			gst_buffer_unref(au);
+			gst_caps_unref(caps);
+		}
+	}
+	free(buf);
+}
+
+static void idr_job_run(gpointer data, gpointer user_data) {
+	struct idr_job *job = data;
+	if (job->buf) {
+		idr_job_spill(job);
+		gst_caps_unref(job->caps);
+		gst_buffer_unref(job->buf);
+	} else
+		idr_job_load(job);
+	g_free(job);
+}
+
+/* Queue a disk job; lock must be held */
+static void idrcache_queue(const char *key, GstCaps *caps, GstBuffer *buf) {
+	struct idr_job *job = g_malloc0(sizeof(struct idr_job));
+	snprintf(job->key, sizeof(job->key), "%s", key);
+	if (buf) {
+		job->caps = gst_caps_ref(caps);
+		job->buf = gst_buffer_ref(buf);
+	}
+	g_thread_pool_push(_worker, job, NULL);
+}
+
+/** Store a keyframe for a camera */
+void idrcache_put(const char *key, GstCaps *caps, GstBuffer *buf) {
+	if (gst_buffer_get_size(buf) > IDR_MAX_BYTES)
+		return;
+	lock_acquire(&_lock, __func__);
+	struct idr_entry *ent = idrcache_find(key, true);
+	gint64 now = g_get_monotonic_time();
+	gint64 spilled = (strcmp(ent->key, key) == 0) ? ent->spilled : 0;
+	idr_entry_clear(ent);
+	snprintf(ent->key, sizeof(ent->key), "%s", key);
+	ent->caps = gst_caps_ref(caps);
+	ent->buf = gst_buffer_ref(buf);
+	ent->used = now;
+	ent->captured = now;
+	ent->spilled = spilled;
+	if (spilled == 0 || now - spilled > IDR_SPILL_US) {
+		idrcache_queue(key, caps, buf);
+		ent->spilled = now;
+	}
+	lock_release(&_lock, __func__);
+}
+
+/** Load the keyframe for a camera from disk in the background, if it is not
+ * in memory.  Called when a stream starts. */
+void idrcache_prefetch(const char *key) {
+	lock_acquire(&_lock, __func__);
+	if (!idrcache_find(key, false))
+		idrcache_queue(key, NULL, NULL);
+	lock_release(&_lock, __func__);
+}
+
+/** Get cached keyframe for a camera, if it matches current caps and is not
+ * too old.  Only memory is checked; see idrcache_prefetch.
+ *
+ * @return New buffer reference, or NULL. */
+GstBuffer *idrcache_get(const char *key, GstCaps *caps) {
+	GstBuffer *buf = NULL;
+	lock_acquire(&_lock, __func__);
+	struct idr_entry *ent = idrcache_find(key, false);
+	gint64 now = g_get_monotonic_time();
+	if (ent && gst_caps_is_equal(ent->caps, caps) &&
+	    now - ent->captured <= IDR_MAX_AGE_US)
+	{
+		ent->used = now;
+		buf = gst_buffer_ref(ent->buf);
+	}
+	lock_release(&_lock, __func__);
+	return buf;
+}
@@ -0,0 +1,12 @@
+#ifndef IDRCACHE_H
+#define IDRCACHE_H
+
+#include <gst/gst.h>
+
+void idrcache_init(void);
+void idrcache_destroy(void);
+void idrcache_put(const char *key, GstCaps *caps, GstBuffer *buf);
+void idrcache_prefetch(const char *key);
+GstBuffer *idrcache_get(const char *key, GstCaps *caps);
+
+#endif
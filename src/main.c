@@ -18,20 +18,25 @@
 #include <curl/curl.h>
 #include "config.h"
 #include "nstr.h"
+#include "still.h"
+#include "stream.h"
 
 #define VERSION "1.13"
 #define BANNER "monstream: v" VERSION "  Copyright (C) 2017-2023  MnDOT\n"
 
 static char *SINK_VAAPI = "sink\x1FVAAPI\x1E";
 static char *SINK_XVIMAGE = "sink\x1FXVIMAGE\x1E";
+static char *SINK_COMPOSITOR = "sink\x1F" "COMPOSITOR\x1E";
 
-void run_player(bool gui, bool stats, const char *port);
+void run_player(bool gui, bool stats, const char *port,
+	const char *metrics_port);
 
 int main(int argc, char* argv[]) {
 	int i;
 	bool gui = true;
 	bool stats = false;
 	const char *port = "7001";
+	const char *metrics_port = NULL;
 	char buf[64];
 	nstr_t str;
 
@@ -39,6 +44,10 @@ int main(int argc, char* argv[]) {
 	for (i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "--no-gui") == 0)
 			gui = false;
+		else if (strcmp(argv[i], "--probe") == 0) {
+			gui = false;
+			stream_config_probe();
+		}
 		else if (strcmp(argv[i], "--sink") == 0) {
 			i++;
 			str = nstr_init(buf, sizeof(buf));
@@ -46,6 +55,8 @@ int main(int argc, char* argv[]) {
 				nstr_cat_z(&str, SINK_VAAPI);
 			else if (strcmp(argv[i], "XVIMAGE") == 0)
 				nstr_cat_z(&str, SINK_XVIMAGE);
+			else if (strcmp(argv[i], "COMPOSITOR") == 0)
+				nstr_cat_z(&str, SINK_COMPOSITOR);
 			else {
 				fprintf(stderr, "Invalid sink: %s\n", argv[i]);
 				goto out;
@@ -54,6 +65,30 @@ int main(int argc, char* argv[]) {
 		} else if (strcmp(argv[i], "--port") == 0) {
 			i++;
 			port = argv[i];
+		} else if (strcmp(argv[i], "--metrics") == 0) {
+			i++;
+			metrics_port = argv[i];
+		} else if (strcmp(argv[i], "--threads") == 0) {
+			i++;
+			if (!stream_config_threads(argv[i])) {
+				fprintf(stderr, "Invalid threads: %s\n",
+					argv[i]);
+				goto out;
+			}
+		} else if (strcmp(argv[i], "--affinity") == 0) {
+			i++;
+			if (!stream_config_affinity(argv[i])) {
+				fprintf(stderr, "Invalid affinity: %s\n",
+					argv[i]);
+				goto out;
+			}
+		} else if (strcmp(argv[i], "--poll") == 0) {
+			i++;
+			if (!still_config_poll(argv[i])) {
+				fprintf(stderr, "Invalid poll: %s\n",
+					argv[i]);
+				goto out;
+			}
 		} else if (strcmp(argv[i], "--stats") == 0)
 			stats = true;
 		else if (strcmp(argv[i], "--test") == 0) {
@@ -70,7 +105,7 @@ int main(int argc, char* argv[]) {
 		}
 	}
 	curl_global_init(CURL_GLOBAL_ALL);
-	run_player(gui, stats, port);
+	run_player(gui, stats, port, metrics_port);
 	curl_global_cleanup();
 out:
 	return 0;
@@ -78,9 +113,15 @@ help:
 	printf("Usage: %s [option]\n", argv[0]);
 	printf("  --version       Display version and exit\n");
 	printf("  --no-gui        Run headless (still connect to streams)\n");
+	printf("  --probe         Check streams headless, without decoding\n");
 	printf("  --stats         Display statistics on stream errors\n");
 	printf("  --port [p]      Listen on given UDP port (default 7001)\n");
+	printf("  --metrics [p]   Serve metrics on given loopback TCP port\n");
+	printf("  --threads [t]   Decoder threads for SD,HD,FHD (0 for auto)\n");
+	printf("  --affinity [c]  Pin cells to CPU sets, such as 0-3:4-7\n");
+	printf("  --poll [s]      Re-fetch PNG images every s seconds\n");
 	printf("  --sink VAAPI    Configure VA-API video acceleration\n");
 	printf("  --sink XVIMAGE  Configure xvimage sink (no acceleration)\n");
+	printf("  --sink COMPOSITOR  Configure one compositor for all cells\n");
 	return 1;
 }
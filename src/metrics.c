@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2026  Minnesota Department of Transportation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "metrics.h"
+
+/*
+ * Per-stream performance metrics.  Pad probes in stream.c feed raw events
+ * (input bytes, decoder in/out, frame arrival), and the periodic sink check
+ * turns them into samples.  Each metric keeps the last METRIC_SAMPLES
+ * samples in a ring, summarized as min / avg / p99.
+ */
+
+void metric_ring_push(struct metric_ring *r, float v) {
+	r->val[r->head] = v;
+	r->head = (r->head + 1) % METRIC_SAMPLES;
+	if (r->count < METRIC_SAMPLES)
+		r->count++;
+}
+
+static int cmp_float(const void *a, const void *b) {
+	float fa = *(const float *) a;
+	float fb = *(const float *) b;
+	return (fa > fb) - (fa < fb);
+}
+
+/** Summarize samples in a ring.
+ *
+ * @return false if ring is empty. */
+bool metric_ring_summary(const struct metric_ring *r,
+	struct metric_summary *ms)
+{
+	float v[METRIC_SAMPLES];
+	double sum = 0;
+
+	memset(ms, 0, sizeof(struct metric_summary));
+	if (r->count == 0)
+		return false;
+	memcpy(v, r->val, r->count * sizeof(float));
+	qsort(v, r->count, sizeof(float), cmp_float);
+	for (uint32_t i = 0; i < r->count; i++)
+		sum += v[i];
+	ms->min = v[0];
+	ms->avg = sum / r->count;
+	ms->p99 = v[(r->count * 99 - 1) / 100];
+	ms->count = r->count;
+	return true;
+}
+
+struct metrics *metrics_create(void) {
+	struct metrics *m = calloc(1, sizeof(struct metrics));
+	lock_init(&m->lock);
+	metrics_reset(m);
+	return m;
+}
+
+void metrics_destroy(struct metrics *m) {
+	lock_destroy(&m->lock);
+	free(m);
+}
+
+/** Clear all samples (on stream start) */
+void metrics_reset(struct metrics *m) {
+	lock_acquire(&m->lock, __func__);
+	__atomic_store_n(&m->bytes, 0, __ATOMIC_RELAXED);
+	m->dropped = 0;
+	m->arrival = 0;
+	m->arrival_ts = GST_CLOCK_TIME_NONE;
+	m->jitter = 0;
+	memset(m->decode_in, 0, sizeof(m->decode_in));
+	m->decode_head = 0;
+	memset(&m->bitrate, 0, sizeof(struct metric_ring));
+	memset(&m->fps, 0, sizeof(struct metric_ring));
+	memset(&m->drops, 0, sizeof(struct metric_ring));
+	memset(&m->decode, 0, sizeof(struct metric_ring));
+	memset(&m->arrival_jitter, 0, sizeof(struct metric_ring));
+	lock_release(&m->lock, __func__);
+}
+
+/** Count input bytes (called for every packet, so no lock) */
+void metrics_add_bytes(struct metrics *m, gsize n_bytes) {
+	__atomic_fetch_add(&m->bytes, n_bytes, __ATOMIC_RELAXED);
+}
+
+void metrics_add_dropped(struct metrics *m, uint32_t n) {
+	lock_acquire(&m->lock, __func__);
+	m->dropped += n;
+	lock_release(&m->lock, __func__);
+}
+
+/* Timestamp used for arrival jitter (decode order) */
+static GstClockTime buffer_ts(GstBuffer *buf) {
+	return GST_BUFFER_DTS_IS_VALID(buf)
+	      ? GST_BUFFER_DTS(buf)
+	      : GST_BUFFER_PTS(buf);
+}
+
+/* Update interarrival jitter estimate (RFC 3550, section 6.4.1) */
+static void metrics_arrival(struct metrics *m, GstClockTime ts, gint64 now) {
+	if (GST_CLOCK_TIME_IS_VALID(m->arrival_ts) && ts > m->arrival_ts) {
+		double d = (now - m->arrival) / 1000.0 -
+			(ts - m->arrival_ts) / (double) GST_MSECOND;
+		m->jitter += (fabs(d) - m->jitter) / 16;
+		metric_ring_push(&m->arrival_jitter, m->jitter);
+	}
+	m->arrival = now;
+	m->arrival_ts = ts;
+}
+
+/** Record a frame going into the decoder */
+void metrics_decode_in(struct metrics *m, GstBuffer *buf) {
+	gint64 now = g_get_monotonic_time();
+	GstClockTime ts = buffer_ts(buf);
+	lock_acquire(&m->lock, __func__);
+	if (GST_CLOCK_TIME_IS_VALID(ts))
+		metrics_arrival(m, ts, now);
+	if (GST_BUFFER_PTS_IS_VALID(buf)) {
+		struct decode_slot *slot = m->decode_in + m->decode_head;
+		slot->pts = GST_BUFFER_PTS(buf);
+		slot->time = now;
+		m->decode_head = (m->decode_head + 1) % DECODE_SLOTS;
+	}
+	lock_release(&m->lock, __func__);
+}
+
+/** Record a frame coming out of the decoder */
+void metrics_decode_out(struct metrics *m, GstBuffer *buf) {
+	gint64 now = g_get_monotonic_time();
+	if (!GST_BUFFER_PTS_IS_VALID(buf))
+		return;
+	lock_acquire(&m->lock, __func__);
+	for (uint32_t i = 0; i < DECODE_SLOTS; i++) {
+		struct decode_slot *slot = m->decode_in + i;
+		if (slot->time && slot->pts == GST_BUFFER_PTS(buf)) {
+			metric_ring_push(&m->decode,
+				(now - slot->time) / 1000.0);
+			slot->time = 0;
+			break;
+		}
+	}
+	lock_release(&m->lock, __func__);
+}
+
+/** Take one sample of interval metrics.
+ *
+ * @param secs Seconds since previous sample.
+ * @param fps Rendered frame rate.
+ * @return Frames dropped since previous sample. */
+uint32_t metrics_sample(struct metrics *m, double secs, double fps) {
+	guint64 bytes = __atomic_exchange_n(&m->bytes, 0, __ATOMIC_RELAXED);
+	lock_acquire(&m->lock, __func__);
+	uint32_t dropped = m->dropped;
+	if (secs > 0) {
+		metric_ring_push(&m->bitrate, bytes * 8 / (secs * 1000));
+		metric_ring_push(&m->fps, fps);
+		metric_ring_push(&m->drops, dropped);
+	}
+	m->dropped = 0;
+	lock_release(&m->lock, __func__);
+	return dropped;
+}
+
+/** Get current interarrival jitter estimate (ms) */
+double metrics_jitter(struct metrics *m) {
+	lock_acquire(&m->lock, __func__);
+	double jitter = m->jitter;
+	lock_release(&m->lock, __func__);
+	return jitter;
+}
+
+static int ring_format(const struct metric_ring *r, const char *name,
+	char *buf, size_t n, int len)
+{
+	struct metric_summary ms;
+	size_t off = MIN((size_t) len, n);
+	metric_ring_summary(r, &ms);
+	return len + snprintf(buf + off, n - off, "%s %.1f/%.1f/%.1f ", name,
+		ms.min, ms.avg, ms.p99);
+}
+
+/** Format metric summaries (min/avg/p99) as text */
+int metrics_format(struct metrics *m, char *buf, size_t n) {
+	int len = 0;
+	lock_acquire(&m->lock, __func__);
+	len = ring_format(&m->bitrate, "kbps", buf, n, len);
+	len = ring_format(&m->fps, "fps", buf, n, len);
+	len = ring_format(&m->drops, "drops", buf, n, len);
+	len = ring_format(&m->decode, "decode_ms", buf, n, len);
+	len = ring_format(&m->arrival_jitter, "jitter_ms", buf, n, len);
+	lock_release(&m->lock, __func__);
+	return len;
+}
+
+static int ring_format_json(const struct metric_ring *r, const char *name,
+	char *buf, size_t n, int len)
+{
+	struct metric_summary ms;
+	size_t off = MIN((size_t) len, n);
+	metric_ring_summary(r, &ms);
+	return len + snprintf(buf + off, n - off,
+		"\"%s\":{\"min\":%.1f,\"avg\":%.1f,\"p99\":%.1f},", name,
+		ms.min, ms.avg, ms.p99);
+}
+
+/** Format metric summaries as JSON members (each followed by a comma) */
+int metrics_format_json(struct metrics *m, char *buf, size_t n) {
+	int len = 0;
+	lock_acquire(&m->lock, __func__);
+	len = ring_format_json(&m->bitrate, "kbps", buf, n, len);
+	len = ring_format_json(&m->fps, "fps", buf, n, len);
+	len = ring_format_json(&m->drops, "drops", buf, n, len);
+	len = ring_format_json(&m->decode, "decode_ms", buf, n, len);
+	len = ring_format_json(&m->arrival_jitter, "jitter_ms", buf, n, len);
+	lock_release(&m->lock, __func__);
+	return len;
+}
@@ -0,0 +1,66 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <gst/gst.h>
+#include "lock.h"
+
+#define METRIC_SAMPLES	(128)
+#define DECODE_SLOTS	(32)
+
+/* Fixed-size ring of samples */
+struct metric_ring {
+	float		val[METRIC_SAMPLES];
+	uint32_t	head;
+	uint32_t	count;
+};
+
+/* Summary of samples in a ring */
+struct metric_summary {
+	float		min;
+	float		avg;
+	float		p99;
+	uint32_t	count;
+};
+
+/* Decoder input time of one frame */
+struct decode_slot {
+	GstClockTime	pts;
+	gint64		time;
+};
+
+struct metrics {
+	struct lock	lock;
+	guint64		bytes;       /* input bytes since sample (atomic) */
+	uint32_t	dropped;     /* dropped frames since sample */
+	gint64		arrival;     /* arrival time of previous frame (us) */
+	GstClockTime	arrival_ts;  /* timestamp of previous frame */
+	double		jitter;      /* interarrival jitter estimate (ms) */
+	struct decode_slot decode_in[DECODE_SLOTS];
+	uint32_t	decode_head;
+	/* one sample per check interval */
+	struct metric_ring bitrate;  /* input kbit/s */
+	struct metric_ring fps;      /* rendered frames/s */
+	struct metric_ring drops;    /* dropped frames */
+	/* one sample per frame */
+	struct metric_ring decode;   /* decoder in->out latency (ms) */
+	struct metric_ring arrival_jitter; /* ms */
+};
+
+void metric_ring_push(struct metric_ring *r, float v);
+bool metric_ring_summary(const struct metric_ring *r,
+	struct metric_summary *ms);
+struct metrics *metrics_create(void);
+void metrics_destroy(struct metrics *m);
+void metrics_reset(struct metrics *m);
+void metrics_add_bytes(struct metrics *m, gsize n_bytes);
+void metrics_add_dropped(struct metrics *m, uint32_t n);
+void metrics_decode_in(struct metrics *m, GstBuffer *buf);
+void metrics_decode_out(struct metrics *m, GstBuffer *buf);
+uint32_t metrics_sample(struct metrics *m, double secs, double fps);
+double metrics_jitter(struct metrics *m);
+int metrics_format(struct metrics *m, char *buf, size_t n);
+int metrics_format_json(struct metrics *m, char *buf, size_t n);
+
+#endif
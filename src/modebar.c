@@ -127,6 +127,10 @@ bool modebar_has_mon(const struct modebar *mbar) {
 	return strlen(mbar->mon);
 }
 
+bool modebar_is_mon(const struct modebar *mbar, const char *mon) {
+	return modebar_has_mon(mbar) && (strcmp(mbar->mon, mon) == 0);
+}
+
 static bool modebar_has_cam(const struct modebar *mbar) {
 	return strlen(mbar->cam);
 }
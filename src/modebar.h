@@ -12,6 +12,7 @@ bool modebar_is_visible(const struct modebar *mbar);
 void modebar_hide(struct modebar *mbar);
 void modebar_set_accent(struct modebar *mbar, int32_t accent, uint32_t font_sz);
 bool modebar_has_mon(const struct modebar *mbar);
+bool modebar_is_mon(const struct modebar *mbar, const char *mon);
 nstr_t modebar_status(struct modebar *mbar, nstr_t str);
 void modebar_display(struct modebar *mbar, nstr_t mon, nstr_t cam, nstr_t seq);
 void modebar_set_tid(struct modebar *mbar, pthread_t tid);
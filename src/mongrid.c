@@ -12,6 +12,7 @@
  * GNU General Public License for more details.
  */
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,16 +20,55 @@
 #include <gdk/gdk.h>
 #include <gdk/gdkx.h>
 #include <gst/gst.h>
+#include <gst/video/video.h>
 #include <gtk/gtk.h>
+#include "adapt.h"
+#include "compositor.h"
+#include "idrcache.h"
 #include "modebar.h"
 #include "elog.h"
 #include "nstr.h"
+#include "still.h"
 #include "stream.h"
 #include "lock.h"
 
 #define ACCENT_GRAY	0x444444
 #define ACCENT_LT_GRAY	0x888888
 #define COLOR_MON	0xFFFF88
+#define HISTORY_LEN	(4)
+#define GRID_GAP	(4)
+
+/* Grid limits: total cells, near-square grid without a layout, and rows or
+ * columns of a page layout */
+#define MAX_CELLS	(128)
+#define MAX_SQUARE	(16)
+#define MAX_SLOTS	(8)
+#define MAX_PAGE_CELLS	(MAX_SLOTS * MAX_SLOTS)
+
+/* CPU governor: drop ratios for overload / headroom, and checks with
+ * headroom before recovering one step */
+#define GOV_OVERLOAD	(0.05)
+#define GOV_HEADROOM	(0.01)
+#define GOV_CALM	(5)
+
+/* Position of a cell on its page, in layout slots */
+struct cell_pos {
+	uint8_t		col;
+	uint8_t		row;
+	uint8_t		width;
+	uint8_t		height;
+};
+
+/* Recent play request for a monitor */
+struct play_rec {
+	char		cam_id[20];
+	char		location[256];   /* requested location(s) */
+	char		description[64];
+	char		encoding[8];
+	char		sprops[160];
+	uint32_t	latency;
+	gboolean	low_latency;
+};
 
 struct moncell {
 	struct stream	stream;          /* must be first, due to casting */
@@ -48,6 +88,22 @@ struct moncell {
 	GtkWidget	*ex_lbl;
 	gboolean	started;
 	gboolean        failed;
+	gboolean	hidden;          /* video area not visible */
+	uint32_t	page;            /* page containing the cell */
+	struct cell_pos	pos;             /* position on page */
+	cairo_surface_t	*frozen;         /* last frame, held while switching */
+	uint32_t	freeze_seq;      /* snapshot while switching (0 none) */
+	gboolean	stale;           /* showing cached keyframe */
+	struct still	*still;          /* still image (instead of stream) */
+	struct stream	standby;         /* hot standby for predicted camera */
+	struct play_rec	history[HISTORY_LEN];
+	gboolean	standby_on;
+	gboolean	standby_ready;
+	struct stream	racer;           /* fallback racing to start */
+	char		fallback[128];   /* fallback location */
+	char		fb_sprops[160];  /* fallback parameter sets */
+	gboolean	racing;
+	gboolean	renditions;      /* request lists renditions */
 };
 
 struct mongrid {
@@ -56,10 +112,20 @@ struct mongrid {
 	GtkWidget	*window;
 	GtkWidget	*tbox;
 	GtkWidget	*grid;
+	struct compositor *comp;
 	struct modebar	*mbar;
 	uint32_t	n_cells;
 	struct moncell	*cells;
+	uint32_t	n_rows;          /* layout slots per page */
+	uint32_t	n_cols;
+	uint32_t	n_pages;
+	uint32_t	page;            /* visible page */
 	bool		running;
+	struct moncell	*selected;       /* selected cell (atomic) */
+	double		load;            /* governor drop ratio estimate */
+	uint32_t	calm;            /* checks with headroom */
+	GThreadPool	*snap_pool;      /* snapshot conversion */
+	uint32_t	freeze_seq;      /* last snapshot sequence */
 };
 
 static struct mongrid grid;
@@ -113,7 +179,10 @@ static void moncell_set_accent(struct moncell *mc) {
 	char css[sizeof(MONCELL_CSS) + 16];
 	GError *err = NULL;
 	int32_t a0 = (mc->accent > 0) ? mc->accent : ACCENT_GRAY;
-	int32_t a1 = (mc->started) ? a0 : ACCENT_GRAY;
+	/* Gray while switching, until the first live frame */
+	int32_t a1 = (mc->started && !mc->freeze_seq && !mc->stale)
+	           ? a0
+	           : ACCENT_GRAY;
 	int32_t a2 = (grid.stats) ? ACCENT_LT_GRAY : a1;
 
 	snprintf(css, sizeof(css), MONCELL_CSS, mc->font_sz, a1, COLOR_MON, a0,
@@ -123,6 +192,51 @@ static void moncell_set_accent(struct moncell *mc) {
 		elog_err("CSS error: %s\n", err->message);
 }
 
+/* Get height of title band in compositor mode (pixels) */
+static int moncell_title_band(const struct moncell *mc) {
+	/* font size is in points; one line plus margin */
+	return moncell_has_title(mc) ? (mc->font_sz * 4 / 3) + 6 : 0;
+}
+
+static void moncell_stop_stream(struct moncell *mc, guint delay);
+
+/* Set size of video area, for all streams of a cell.  The stream is restarted
+ * when its decoding quality changes, as for a rendition change. */
+static void moncell_set_size(struct moncell *mc, int width, int height) {
+	bool changed = stream_set_size(&mc->stream, width, height);
+	stream_set_size(&mc->standby, width, height);
+	stream_set_size(&mc->racer, width, height);
+	if (changed && mc->started) {
+		elog_err("Quality %s: %dx%d\n", mc->stream.cam_id, width,
+			height);
+		moncell_stop_stream(mc, 20);
+	}
+}
+
+/* Set cell rectangle and title band in compositor mode */
+static void moncell_compose(struct moncell *mc) {
+	uint32_t idx = mc - grid.cells;
+	int width = gtk_widget_get_allocated_width(grid.grid);
+	int height = gtk_widget_get_allocated_height(grid.grid);
+	int sw = (width - (grid.n_cols - 1) * GRID_GAP) / grid.n_cols;
+	int sh = (height - (grid.n_rows - 1) * GRID_GAP) / grid.n_rows;
+	int x = mc->pos.col * (sw + GRID_GAP);
+	int y = mc->pos.row * (sh + GRID_GAP);
+	int w = mc->pos.width * (sw + GRID_GAP) - GRID_GAP;
+	int h = mc->pos.height * (sh + GRID_GAP) - GRID_GAP;
+	int band = moncell_title_band(mc);
+	char text[128];
+	if (moncell_has_title(mc)) {
+		snprintf(text, sizeof(text), "%s  %s  %s  %s", mc->mid,
+			moncell_get_cam_id(mc), mc->description, mc->extra);
+	} else
+		text[0] = '\0';
+	compositor_set_cell(grid.comp, idx, x, y, w, MAX(h - band, 1),
+		mc->stream.aspect);
+	moncell_set_size(mc, w, MAX(h - band, 1));
+	compositor_set_title(grid.comp, idx, mc->font_sz, text);
+}
+
 static void moncell_update_title(struct moncell *mc) {
 	/* Hide titlebar when monitor ID is blank */
 	if (moncell_has_title(mc)) {
@@ -136,6 +250,8 @@ static void moncell_update_title(struct moncell *mc) {
 			gtk_widget_hide(mc->ex_lbl);
 	} else
 		gtk_widget_hide(mc->title);
+	if (grid.comp)
+		moncell_compose(mc);
 }
 
 static void moncell_update_accent_title(struct moncell *mc) {
@@ -143,6 +259,47 @@ static void moncell_update_accent_title(struct moncell *mc) {
 	moncell_update_title(mc);
 }
 
+/* Draw description text, as the stream overlay does */
+static void moncell_draw_text(struct moncell *mc, cairo_t *cr, int width) {
+	char font[32];
+	int w, h;
+	snprintf(font, sizeof(font), "Overpass, Bold %d", mc->stream.font_sz);
+	PangoLayout *layout = pango_cairo_create_layout(cr);
+	PangoFontDescription *desc = pango_font_description_from_string(font);
+	pango_layout_set_font_description(layout, desc);
+	pango_font_description_free(desc);
+	pango_layout_set_text(layout, mc->stream.description, -1);
+	pango_layout_get_pixel_size(layout, &w, &h);
+	cairo_move_to(cr, width - w - 48, 36);
+	cairo_set_source_rgba(cr, 1, 1, 1, 0xE0 / 255.0);
+	pango_cairo_show_layout(cr, layout);
+	g_object_unref(layout);
+}
+
+/* Draw still image, scaled to fit the cell */
+static void moncell_draw_still(struct moncell *mc, cairo_t *cr, int width,
+	int height)
+{
+	cairo_surface_t *surf = still_surface(mc->still);
+	if (surf) {
+		int w = cairo_image_surface_get_width(surf);
+		int h = cairo_image_surface_get_height(surf);
+		double sx = (double) width / w;
+		double sy = (double) height / h;
+		if (mc->stream.aspect)
+			sx = sy = MIN(sx, sy);
+		cairo_save(cr);
+		cairo_translate(cr, (width - w * sx) / 2, (height - h * sy) / 2);
+		cairo_scale(cr, sx, sy);
+		cairo_set_source_surface(cr, surf, 0, 0);
+		cairo_paint(cr);
+		cairo_restore(cr);
+		cairo_surface_destroy(surf);
+	}
+	if (mc->stream.description[0])
+		moncell_draw_text(mc, cr, width);
+}
+
 static gboolean draw_cb(GtkWidget *widget, cairo_t *cr, gpointer data) {
 	struct moncell *mc = data;
 	lock_acquire(&grid.lock, __func__);
@@ -152,25 +309,211 @@ static gboolean draw_cb(GtkWidget *widget, cairo_t *cr, gpointer data) {
 		guint height = gtk_widget_get_allocated_height(widget);
 		cairo_rectangle(cr, 0, 0, width, height);
 		cairo_fill(cr);
+		if (mc->still)
+			moncell_draw_still(mc, cr, width, height);
+		else if (mc->frozen) {
+			int w = cairo_image_surface_get_width(mc->frozen);
+			int h = cairo_image_surface_get_height(mc->frozen);
+			cairo_set_source_surface(cr, mc->frozen,
+				((int) width - w) / 2, ((int) height - h) / 2);
+			/* Dimmed, to show it is not live */
+			cairo_paint_with_alpha(cr, 0.6);
+		}
 	}
 	lock_release(&grid.lock, __func__);
 	return TRUE;
 }
 
+/* Update hidden state of streams.  A primary stays visible while any cell
+ * sharing its decoder is visible. */
+/* Check if a cell's stream is not seen, in the cell or any follower */
+static bool moncell_is_unseen(const struct moncell *mc) {
+	bool hidden = mc->hidden;
+	for (uint32_t f = 0; hidden && f < grid.n_cells; f++) {
+		struct moncell *fc = grid.cells + f;
+		if (fc->stream.primary == &mc->stream && !fc->hidden)
+			hidden = false;
+	}
+	return hidden;
+}
+
+static void mongrid_update_hidden(void) {
+	for (uint32_t n = 0; n < grid.n_cells; n++) {
+		struct moncell *mc = grid.cells + n;
+		stream_set_hidden(&mc->stream, moncell_is_unseen(mc));
+	}
+}
+
+/* Check if hidden state of any stream is out of date */
+static bool mongrid_is_hidden_changed(void) {
+	for (uint32_t n = 0; n < grid.n_cells; n++) {
+		struct moncell *mc = grid.cells + n;
+		if (mc->stream.hidden != moncell_is_unseen(mc))
+			return true;
+	}
+	return false;
+}
+
+static void moncell_set_hidden(struct moncell *mc, bool hidden) {
+	if (mc->hidden != hidden) {
+		mc->hidden = hidden;
+		mongrid_update_hidden();
+	}
+}
+
+static gboolean visibility_cb(GtkWidget *widget, GdkEventVisibility *ev,
+	gpointer data)
+{
+	struct moncell *mc = data;
+	lock_acquire(&grid.lock, __func__);
+	if (is_moncell_valid(mc)) {
+		moncell_set_hidden(mc,
+			ev->state == GDK_VISIBILITY_FULLY_OBSCURED);
+	}
+	lock_release(&grid.lock, __func__);
+	return FALSE;
+}
+
+static gboolean map_cb(GtkWidget *widget, GdkEvent *ev, gpointer data) {
+	struct moncell *mc = data;
+	lock_acquire(&grid.lock, __func__);
+	if (is_moncell_valid(mc))
+		moncell_set_hidden(mc, false);
+	lock_release(&grid.lock, __func__);
+	return FALSE;
+}
+
+static gboolean unmap_cb(GtkWidget *widget, GdkEvent *ev, gpointer data) {
+	struct moncell *mc = data;
+	lock_acquire(&grid.lock, __func__);
+	if (is_moncell_valid(mc))
+		moncell_set_hidden(mc, true);
+	lock_release(&grid.lock, __func__);
+	return FALSE;
+}
+
+static gboolean do_set_size(gpointer data) {
+	struct moncell *mc = data;
+	lock_acquire(&grid.lock, __func__);
+	/* moncell may have been freed while timer ran */
+	if (is_moncell_valid(mc)) {
+		moncell_set_size(mc, gtk_widget_get_allocated_width(mc->video),
+			gtk_widget_get_allocated_height(mc->video));
+	}
+	lock_release(&grid.lock, __func__);
+	return FALSE;
+}
+
+/* Emitted synchronously, while grid lock may be held (show_all) */
+static void size_allocate_cb(GtkWidget *widget, GdkRectangle *alloc,
+	gpointer data)
+{
+	g_timeout_add(0, do_set_size, data);
+}
+
+/* Create an image surface from a BGRx sample */
+static cairo_surface_t *surface_from_sample(GstSample *s) {
+	GstVideoInfo info;
+	GstMapInfo map;
+	cairo_surface_t *surf = NULL;
+	GstBuffer *buf = gst_sample_get_buffer(s);
+	GstCaps *caps = gst_sample_get_caps(s);
+	if (!buf || !caps || !gst_video_info_from_caps(&info, caps))
+		return NULL;
+	if (gst_buffer_map(buf, &map, GST_MAP_READ)) {
+		int w = GST_VIDEO_INFO_WIDTH(&info);
+		int h = GST_VIDEO_INFO_HEIGHT(&info);
+		int stride = GST_VIDEO_INFO_PLANE_STRIDE(&info, 0);
+		surf = cairo_image_surface_create(CAIRO_FORMAT_RGB24, w, h);
+		unsigned char *data = cairo_image_surface_get_data(surf);
+		int s_stride = cairo_image_surface_get_stride(surf);
+		cairo_surface_flush(surf);
+		for (int y = 0; data && y < h; y++) {
+			memcpy(data + y * s_stride, map.data + y * stride,
+				MIN(s_stride, stride));
+		}
+		cairo_surface_mark_dirty(surf);
+		gst_buffer_unmap(buf, &map);
+	}
+	return surf;
+}
+
 static void moncell_clear(struct moncell *mc) {
 	guint width = gtk_widget_get_allocated_width(mc->video);
 	guint height = gtk_widget_get_allocated_height(mc->video);
 	gtk_widget_queue_draw_area(mc->video, 0, 0, width, height);
 }
 
-static void moncell_restart_stream(struct moncell *mc) {
-	if (!mc->started) {
-		bool s = stream_start(&mc->stream);
-		mc->started = TRUE;
-		if (grid.window && !s) {
-			moncell_update_accent_title(mc);
-			moncell_clear(mc);
-		}
+/* Release frozen frame, and drop any pending snapshot */
+static void moncell_thaw(struct moncell *mc) {
+	mc->freeze_seq = 0;
+	if (mc->frozen) {
+		cairo_surface_destroy(mc->frozen);
+		mc->frozen = NULL;
+	}
+}
+
+/* Snapshot conversion, from last sample to surface */
+struct snap_job {
+	struct moncell	*mc;
+	uint32_t	seq;
+	GstSample	*sample;
+	gboolean	aspect;
+	gint		width;
+	gint		height;
+	cairo_surface_t	*surf;
+};
+
+static gboolean do_frozen(gpointer data) {
+	struct snap_job *sj = data;
+	lock_acquire(&grid.lock, __func__);
+	/* moncell may have been freed or thawed while converting */
+	if (is_moncell_valid(sj->mc) && sj->mc->freeze_seq == sj->seq &&
+	    !sj->mc->frozen)
+	{
+		sj->mc->frozen = sj->surf;
+		sj->surf = NULL;
+		moncell_clear(sj->mc);
+	}
+	lock_release(&grid.lock, __func__);
+	if (sj->surf)
+		cairo_surface_destroy(sj->surf);
+	g_free(sj);
+	return FALSE;
+}
+
+/* Convert snapshot on a pool thread, off the main loop */
+static void snap_convert(gpointer data, gpointer user_data) {
+	struct snap_job *sj = data;
+	GstSample *s = stream_snapshot(sj->sample, sj->aspect, sj->width,
+		sj->height);
+	gst_sample_unref(sj->sample);
+	if (s) {
+		sj->surf = surface_from_sample(s);
+		gst_sample_unref(s);
+	}
+	g_timeout_add(0, do_frozen, sj);
+}
+
+/* Keep last rendered frame, to draw until the next stream starts.  The sample
+ * is only referenced here; it is converted in the background. */
+static void moncell_freeze(struct moncell *mc) {
+	moncell_thaw(mc);
+	if (grid.comp || mc->still)
+		return;
+	if (0 == ++grid.freeze_seq)
+		grid.freeze_seq = 1;
+	mc->freeze_seq = grid.freeze_seq;
+	GstSample *s = stream_last_sample(&mc->stream);
+	if (s) {
+		struct snap_job *sj = g_malloc0(sizeof(struct snap_job));
+		sj->mc = mc;
+		sj->seq = mc->freeze_seq;
+		sj->sample = s;
+		sj->aspect = mc->stream.aspect;
+		sj->width = gtk_widget_get_allocated_width(mc->video);
+		sj->height = gtk_widget_get_allocated_height(mc->video);
+		g_thread_pool_push(grid.snap_pool, sj, NULL);
 	}
 }
 
@@ -188,11 +531,156 @@ static gboolean do_update_title(gpointer data) {
 	return FALSE;
 }
 
+/* Stop all cells which share the decoder of a cell; they will restart */
+static void moncell_release_followers(struct moncell *mc) {
+	for (uint32_t n = 0; n < grid.n_cells; n++) {
+		struct moncell *fc = grid.cells + n;
+		if (fc->stream.primary == &mc->stream) {
+			stream_stop(&fc->stream);
+			moncell_stop_stream(fc, 20);
+		}
+	}
+}
+
+/* Find a playing cell with the same source, to share its decoder */
+static struct moncell *moncell_find_primary(const struct moncell *mc) {
+	for (uint32_t n = 0; n < grid.n_cells; n++) {
+		struct moncell *pc = grid.cells + n;
+		if (pc != mc && pc->started && !pc->stream.primary &&
+		    !pc->still &&
+		    stream_can_share(&mc->stream, &pc->stream))
+			return pc;
+	}
+	return NULL;
+}
+
+/* Check if another cell plays the same source as a stream, so the stream
+ * needs a tee to share its decoder */
+static bool moncell_has_peer(const struct moncell *mc, const struct stream *st) {
+	for (uint32_t n = 0; n < grid.n_cells; n++) {
+		struct moncell *pc = grid.cells + n;
+		if (pc != mc && !pc->still &&
+		    stream_is_same_feed(&pc->stream, st))
+			return true;
+	}
+	return false;
+}
+
+/* Restart playing cells with the same source which have no tee, so they
+ * can follow a cell starting with one */
+static void moncell_restart_peers(struct moncell *mc) {
+	for (uint32_t n = 0; n < grid.n_cells; n++) {
+		struct moncell *pc = grid.cells + n;
+		if (pc != mc && pc->started && !pc->still &&
+		    !pc->stream.primary && !pc->stream.tee &&
+		    stream_is_same_feed(&pc->stream, &mc->stream))
+			moncell_stop_stream(pc, 20);
+	}
+}
+
+/* Check if an encoding is drawn as a still image, without a pipeline */
+static bool is_still(const char *encoding) {
+	return grid.window && !grid.comp && strcmp("PNG", encoding) == 0;
+}
+
+static gboolean do_still_ready(gpointer data) {
+	struct moncell *mc = (struct moncell *) data;
+	lock_acquire(&grid.lock, __func__);
+	/* moncell may have been freed while timer ran */
+	if (is_moncell_valid(mc) && mc->still) {
+		moncell_thaw(mc);
+		moncell_clear(mc);
+	}
+	lock_release(&grid.lock, __func__);
+	return FALSE;
+}
+
+/* Called from still fetch thread */
+static void moncell_still_ready(void *data) {
+	g_timeout_add(0, do_still_ready, data);
+}
+
+static bool moncell_start_still(struct moncell *mc) {
+	mc->still = still_start(mc->stream.location, moncell_still_ready, mc);
+	g_timeout_add(0, do_update_title, mc);
+	return mc->still != NULL;
+}
+
+static void moncell_stop_still(struct moncell *mc) {
+	if (mc->still) {
+		still_stop(mc->still);
+		mc->still = NULL;
+	}
+}
+
+static bool moncell_is_selected(const struct moncell *mc) {
+	return (grid.mbar) && moncell_has_title(mc)
+	    && modebar_is_mon(grid.mbar, mc->mid);
+}
+
+/* Remember the selected cell, so it can be checked without the grid lock */
+static void mongrid_update_selected(void) {
+	struct moncell *sel = NULL;
+	for (uint32_t n = 0; n < grid.n_cells && !sel; n++) {
+		if (moncell_is_selected(grid.cells + n))
+			sel = grid.cells + n;
+	}
+	g_atomic_pointer_set(&grid.selected, sel);
+}
+
+/* Check if a cell should play full resolution */
+static bool moncell_is_full(const struct moncell *mc) {
+	return 1 == grid.n_cells || moncell_is_selected(mc);
+}
+
+static void moncell_start_racer(struct moncell *mc);
+static void moncell_stop_racer(struct moncell *mc);
+
+static bool moncell_start(struct moncell *mc) {
+	stream_select_rendition(&mc->stream, moncell_is_full(mc));
+	if (is_still(mc->stream.encoding))
+		return moncell_start_still(mc);
+	struct moncell *pc = moncell_find_primary(mc);
+	if (pc && stream_follow(&mc->stream, &pc->stream)) {
+		moncell_thaw(mc);
+		if (grid.window)
+			g_timeout_add(0, do_update_title, mc);
+		return true;
+	}
+	bool share = moncell_has_peer(mc, &mc->stream);
+	stream_set_shareable(&mc->stream, share);
+	moncell_start_racer(mc);
+	bool s = stream_start(&mc->stream);
+	if (s && share)
+		moncell_restart_peers(mc);
+	return s;
+}
+
+static void moncell_restart_stream(struct moncell *mc) {
+	if (!mc->started) {
+		moncell_release_followers(mc);
+		bool s = moncell_start(mc);
+		mc->started = TRUE;
+		if (grid.window && !s) {
+			moncell_thaw(mc);
+			moncell_update_accent_title(mc);
+			moncell_clear(mc);
+		}
+	}
+}
+
 static gboolean do_stop_stream(gpointer data) {
 	struct moncell *mc = (struct moncell *) data;
 	lock_acquire(&grid.lock, __func__);
 	/* moncell may have been freed while timer ran */
 	if (is_moncell_valid(mc)) {
+		moncell_release_followers(mc);
+		if (grid.window)
+			moncell_freeze(mc);
+		moncell_stop_still(mc);
+		/* After a failure, a racing fallback may still win */
+		if (!mc->failed)
+			moncell_stop_racer(mc);
 		stream_stop(&mc->stream);
 		if (grid.window)
 			moncell_clear(mc);
@@ -220,6 +708,252 @@ static void moncell_stop_stream(struct moncell *mc, guint delay) {
 	g_timeout_add(delay, do_restart, mc);
 }
 
+static void play_rec_from_stream(struct play_rec *pr, const struct stream *st)
+{
+	memcpy(pr->cam_id, st->cam_id, sizeof(pr->cam_id));
+	memcpy(pr->location, st->renditions, sizeof(pr->location));
+	memcpy(pr->description, st->description, sizeof(pr->description));
+	memcpy(pr->encoding, st->encoding, sizeof(pr->encoding));
+	memcpy(pr->sprops, st->sprops, sizeof(pr->sprops));
+	pr->latency = st->latency;
+	pr->low_latency = st->low_latency;
+}
+
+static nstr_t play_rec_nstr(char *buf, size_t n) {
+	return nstr_init_n(buf, n, strlen(buf));
+}
+
+/* Push currently playing stream onto history */
+static void moncell_push_history(struct moncell *mc) {
+	const struct stream *st = &mc->stream;
+	uint32_t n = HISTORY_LEN - 1;
+	if (0 == st->renditions[0])
+		return;
+	/* Remove older entry for the same location */
+	for (uint32_t i = 0; i < HISTORY_LEN - 1; i++) {
+		if (strcmp(mc->history[i].location, st->renditions) == 0) {
+			n = i;
+			break;
+		}
+	}
+	memmove(mc->history + 1, mc->history, n * sizeof(struct play_rec));
+	play_rec_from_stream(mc->history, st);
+}
+
+/* Predict next camera -- the most recent one which is not playing now.
+ * Stepping through cameras with next/previous, or toggling between two
+ * cameras, usually returns to it. */
+static struct play_rec *moncell_predict(struct moncell *mc) {
+	for (uint32_t i = 0; i < HISTORY_LEN; i++) {
+		struct play_rec *pr = mc->history + i;
+		if (pr->location[0] &&
+		    strcmp(pr->location, mc->stream.renditions) != 0)
+			return pr;
+	}
+	return NULL;
+}
+
+static bool moncell_standby_has(const struct moncell *mc,
+	const struct play_rec *pr)
+{
+	const struct stream *sb = &mc->standby;
+	return mc->standby_on
+	    && (strcmp(sb->renditions, pr->location) == 0)
+	    && (strcmp(sb->encoding, pr->encoding) == 0)
+	    && (strcmp(sb->sprops, pr->sprops) == 0);
+}
+
+static void moncell_start_standby(struct moncell *mc, struct play_rec *pr) {
+	struct stream *sb = &mc->standby;
+	stream_set_params(sb,
+		play_rec_nstr(pr->cam_id, sizeof(pr->cam_id)),
+		play_rec_nstr(pr->location, sizeof(pr->location)),
+		play_rec_nstr(pr->description, sizeof(pr->description)),
+		play_rec_nstr(pr->encoding, sizeof(pr->encoding)),
+		pr->latency,
+		play_rec_nstr(pr->sprops, sizeof(pr->sprops)));
+	stream_set_low_latency(sb, pr->low_latency);
+	/* Match the cell, so the chain key allows a swap */
+	struct stream *st = &mc->stream;
+	stream_set_key_only(sb, st->key_only);
+	stream_set_aspect(sb, st->aspect);
+	stream_set_font_size(sb, st->font_sz);
+	stream_set_crop(sb, play_rec_nstr(st->crop, sizeof(st->crop)),
+		st->hgap, st->vgap);
+	stream_set_shareable(sb, moncell_has_peer(mc, sb));
+	/* Standby only runs for the selected monitor */
+	stream_select_rendition(sb, true);
+	mc->standby_ready = FALSE;
+	mc->standby_on = stream_start(sb);
+}
+
+static void moncell_stop_standby(struct moncell *mc) {
+	stream_stop(&mc->standby);
+	mc->standby_on = FALSE;
+	mc->standby_ready = FALSE;
+}
+
+/* Switch rendition when the cell size or selection has changed */
+static void moncell_check_rendition(struct moncell *mc) {
+	if (mc->started && !mc->hidden &&
+	    stream_select_rendition(&mc->stream, moncell_is_full(mc)))
+	{
+		elog_err("Rendition %s: %s\n", moncell_get_cam_id(mc),
+			mc->stream.location);
+		moncell_stop_stream(mc, 20);
+	}
+}
+
+/* Gray the title while a cached keyframe is shown instead of live video */
+static void moncell_check_stale(struct moncell *mc) {
+	gboolean stale = mc->started && stream_is_stale(&mc->stream);
+	if (grid.window && stale != mc->stale) {
+		mc->stale = stale;
+		moncell_update_accent_title(mc);
+	}
+}
+
+/* Keep a standby pipeline running for the selected monitor only */
+static void moncell_check_standby(struct moncell *mc) {
+	struct play_rec *pr = moncell_predict(mc);
+	/* Still images start quickly without a standby */
+	if (pr && moncell_is_selected(mc) && !is_still(pr->encoding)) {
+		if (!moncell_standby_has(mc, pr))
+			moncell_start_standby(mc, pr);
+	} else if (mc->standby_on)
+		moncell_stop_standby(mc);
+}
+
+static struct moncell *moncell_from_standby(struct stream *st) {
+	return (struct moncell *) ((char *) st -
+		offsetof(struct moncell, standby));
+}
+
+static gboolean do_stop_standby(gpointer data) {
+	struct moncell *mc = (struct moncell *) data;
+	lock_acquire(&grid.lock, __func__);
+	/* moncell may have been freed while timer ran */
+	if (is_moncell_valid(mc))
+		moncell_stop_standby(mc);
+	lock_release(&grid.lock, __func__);
+	return FALSE;
+}
+
+static void moncell_standby_stop(struct stream *st) {
+	struct moncell *mc = moncell_from_standby(st);
+	mc->standby_ready = FALSE;
+	g_timeout_add(0, do_stop_standby, mc);
+}
+
+static void moncell_standby_ack(struct stream *st) {
+	struct moncell *mc = moncell_from_standby(st);
+	mc->standby_ready = mc->standby_on;
+}
+
+static gboolean do_swap_standby(gpointer data) {
+	struct moncell *mc = (struct moncell *) data;
+	lock_acquire(&grid.lock, __func__);
+	/* moncell may have been freed while timer ran */
+	if (is_moncell_valid(mc)) {
+		moncell_release_followers(mc);
+		moncell_stop_still(mc);
+		if (mc->standby_ready &&
+		    stream_swap_standby(&mc->stream, &mc->standby))
+		{
+			moncell_stop_racer(mc);
+			mc->standby_on = FALSE;
+			mc->standby_ready = FALSE;
+			mc->started = TRUE;
+			moncell_thaw(mc);
+			if (grid.window)
+				moncell_update_accent_title(mc);
+		} else
+			moncell_stop_stream(mc, 20);
+	}
+	lock_release(&grid.lock, __func__);
+	return FALSE;
+}
+
+static struct moncell *moncell_from_racer(struct stream *st) {
+	return (struct moncell *) ((char *) st -
+		offsetof(struct moncell, racer));
+}
+
+/* Start the fallback location racing the stream, unless still racing from
+ * before a failure.  Whichever delivers a decoded frame first wins. */
+static void moncell_start_racer(struct moncell *mc) {
+	struct stream *st = &mc->stream;
+	struct stream *rc = &mc->racer;
+	if (0 == mc->fallback[0] || mc->racing ||
+	    strcmp(mc->fallback, st->location) == 0)
+		return;
+	stream_set_params(rc,
+		play_rec_nstr(st->cam_id, sizeof(st->cam_id)),
+		play_rec_nstr(mc->fallback, sizeof(mc->fallback)),
+		play_rec_nstr(st->description, sizeof(st->description)),
+		play_rec_nstr(st->encoding, sizeof(st->encoding)),
+		st->latency,
+		play_rec_nstr(mc->fb_sprops, sizeof(mc->fb_sprops)));
+	stream_set_low_latency(rc, st->low_latency);
+	stream_set_shareable(rc, st->shareable);
+	stream_set_key_only(rc, st->key_only);
+	stream_set_aspect(rc, st->aspect);
+	stream_set_font_size(rc, st->font_sz);
+	stream_set_crop(rc, play_rec_nstr(st->crop, sizeof(st->crop)),
+		st->hgap, st->vgap);
+	mc->racing = stream_start(rc);
+}
+
+/* Tear down the losing racer; it is not reused like a stopped stream */
+static void moncell_stop_racer(struct moncell *mc) {
+	stream_teardown(&mc->racer);
+	mc->racing = FALSE;
+}
+
+static gboolean do_stop_racer(gpointer data) {
+	struct moncell *mc = (struct moncell *) data;
+	lock_acquire(&grid.lock, __func__);
+	/* moncell may have been freed while timer ran */
+	if (is_moncell_valid(mc))
+		moncell_stop_racer(mc);
+	lock_release(&grid.lock, __func__);
+	return FALSE;
+}
+
+static gboolean do_race_won(gpointer data) {
+	struct moncell *mc = (struct moncell *) data;
+	lock_acquire(&grid.lock, __func__);
+	/* moncell may have been freed while timer ran */
+	if (is_moncell_valid(mc) && mc->racing) {
+		moncell_release_followers(mc);
+		if (stream_swap_racer(&mc->stream, &mc->racer)) {
+			elog_err("Fallback won %s: %s\n",
+				moncell_get_cam_id(mc), mc->racer.location);
+			mc->racing = FALSE;
+			mc->started = TRUE;
+			mc->failed = FALSE;
+			moncell_thaw(mc);
+			if (grid.window)
+				moncell_update_accent_title(mc);
+		} else
+			moncell_stop_racer(mc);
+	}
+	lock_release(&grid.lock, __func__);
+	return FALSE;
+}
+
+/* The fallback failed; the stream keeps going alone */
+static void moncell_racer_stop(struct stream *st) {
+	struct moncell *mc = moncell_from_racer(st);
+	g_timeout_add(0, do_stop_racer, mc);
+}
+
+static void moncell_racer_ack(struct stream *st) {
+	struct moncell *mc = moncell_from_racer(st);
+	if (mc->racing)
+		g_timeout_add(0, do_race_won, mc);
+}
+
 static void moncell_stop(struct stream *st) {
 	/* Cast requires stream is first member of struct */
 	struct moncell *mc = (struct moncell *) st;
@@ -231,6 +965,12 @@ static void moncell_ack_started(struct stream *st) {
 	/* Cast requires stream is first member of struct */
 	struct moncell *mc = (struct moncell *) st;
 	mc->failed = FALSE;
+	/* The stream won the race */
+	if (mc->racing) {
+		mc->racing = FALSE;
+		g_timeout_add(0, do_stop_racer, mc);
+	}
+	moncell_thaw(mc);
 	g_timeout_add(0, do_update_title, mc);
 }
 
@@ -266,6 +1006,17 @@ static void moncell_init_gtk(struct moncell *mc) {
 	mc->box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
 	mc->video = gtk_drawing_area_new();
 	g_signal_connect(G_OBJECT(mc->video), "draw", G_CALLBACK(draw_cb), mc);
+	g_signal_connect(G_OBJECT(mc->video), "size-allocate",
+		G_CALLBACK(size_allocate_cb), mc);
+	/* Cells are never mapped in compositor mode, so stay visible */
+	gtk_widget_add_events(mc->video, GDK_VISIBILITY_NOTIFY_MASK |
+		GDK_STRUCTURE_MASK);
+	g_signal_connect(G_OBJECT(mc->video), "visibility-notify-event",
+		G_CALLBACK(visibility_cb), mc);
+	g_signal_connect(G_OBJECT(mc->video), "map-event",
+		G_CALLBACK(map_cb), mc);
+	g_signal_connect(G_OBJECT(mc->video), "unmap-event",
+		G_CALLBACK(unmap_cb), mc);
 	mc->title = create_title(mc);
 	mc->mon_lbl = create_label(mc->css_provider, "mon_lbl", 6);
 	mc->stat_lbl = create_label(mc->css_provider, "stat_lbl", 0);
@@ -287,6 +1038,12 @@ static void moncell_init(struct moncell *mc, uint32_t idx, nstr_t sink_name) {
 	memset(mc, 0, sizeof(struct moncell));
 	stream_init(&mc->stream, idx, &grid.lock, sink_name);
 	mc->stream.do_stop = moncell_stop;
+	stream_init(&mc->standby, idx, &grid.lock, sink_name);
+	mc->standby.do_stop = moncell_standby_stop;
+	mc->standby.ack_started = moncell_standby_ack;
+	stream_init(&mc->racer, idx, &grid.lock, sink_name);
+	mc->racer.do_stop = moncell_racer_stop;
+	mc->racer.ack_started = moncell_racer_ack;
 	mc->font_sz = 32;
 	mc->started = FALSE;
 	mc->failed = FALSE;
@@ -294,7 +1051,20 @@ static void moncell_init(struct moncell *mc, uint32_t idx, nstr_t sink_name) {
 		moncell_init_gtk(mc);
 }
 
+/* In compositor mode, cell widgets only hold title text, and are never packed
+ * into the grid */
+static void moncell_init_compositor(struct moncell *mc, uint32_t idx) {
+	char channel[8];
+	compositor_channel(idx, channel, sizeof(channel));
+	stream_set_channel(&mc->stream, channel);
+	g_object_ref_sink(mc->box);
+}
+
 static void moncell_destroy(struct moncell *mc) {
+	moncell_stop_still(mc);
+	moncell_thaw(mc);
+	stream_destroy(&mc->racer);
+	stream_destroy(&mc->standby);
 	stream_destroy(&mc->stream);
 	if (grid.window) {
 		gtk_widget_destroy(mc->mon_lbl);
@@ -305,36 +1075,54 @@ static void moncell_destroy(struct moncell *mc) {
 		gtk_widget_destroy(mc->video);
 		gtk_widget_destroy(mc->title);
 		gtk_widget_destroy(mc->box);
+		if (grid.comp)
+			g_object_unref(mc->box);
 	}
 }
 
 static void moncell_set_handle(struct moncell *mc) {
+	/* Cells on other pages are not realized with the window */
+	gtk_widget_realize(mc->video);
 	guintptr handle = GDK_WINDOW_XID(gtk_widget_get_window(mc->video));
 	stream_set_handle(&mc->stream, handle);
 }
 
 static void moncell_play_stream(struct moncell *mc, nstr_t cam_id, nstr_t loc,
-	nstr_t desc, nstr_t encoding, uint32_t latency, nstr_t sprops)
+	nstr_t desc, nstr_t encoding, uint32_t latency, nstr_t sprops,
+	bool low_latency, nstr_t fallback, nstr_t fb_sprops)
 {
 	/* Only set text overlay description when there's no title bar */
 	nstr_t dtxt = moncell_has_title(mc) ? nstr_init_empty() : desc;
 	mc->failed = FALSE;
+	nstr_to_cstr(mc->fallback, sizeof(mc->fallback), fallback);
+	nstr_to_cstr(mc->fb_sprops, sizeof(mc->fb_sprops), fb_sprops);
+	mc->renditions = nstr_contains(loc, " ");
 	moncell_set_description(mc, desc);
+	if (!nstr_cmp_z(loc, mc->stream.renditions))
+		moncell_push_history(mc);
 	stream_set_params(&mc->stream, cam_id, loc, dtxt, encoding, latency,
 		sprops);
-	/* Stopping the stream will trigger a restart */
-	moncell_stop_stream(mc, 20);
+	stream_select_rendition(&mc->stream, moncell_is_full(mc));
+	stream_set_low_latency(&mc->stream, low_latency);
+	if (mc->standby_ready)
+		g_timeout_add(0, do_swap_standby, mc);
+	else {
+		/* Stopping the stream will trigger a restart */
+		moncell_stop_stream(mc, 20);
+	}
 }
 
 static void moncell_set_mon(struct moncell *mc, nstr_t mid, int32_t accent,
 	bool aspect, uint32_t font_sz, nstr_t crop, uint32_t hgap,
-	uint32_t vgap, nstr_t extra)
+	uint32_t vgap, nstr_t extra, bool key_only)
 {
 	nstr_to_cstr(mc->mid, sizeof(mc->mid), mid);
 	mc->accent = accent;
 	stream_set_aspect(&mc->stream, aspect);
 	stream_set_font_size(&mc->stream, font_sz);
 	stream_set_crop(&mc->stream, crop, hgap, vgap);
+	stream_set_key_only(&mc->stream, key_only);
+	stream_set_key_only(&mc->standby, key_only);
 	nstr_to_cstr(mc->extra, sizeof(mc->extra), extra);
 	mc->font_sz = font_sz;
 	if (grid.window)
@@ -381,9 +1169,10 @@ static void hide_cursor(GtkWidget *window) {
 static void moncell_update_stats(struct moncell *mc, guint64 pushed,
 	guint64 lost, guint64 late)
 {
-	char buf[16];
+	char buf[32];
 	snprintf(buf, sizeof(buf), "%" G_GUINT64_FORMAT "  %" G_GUINT64_FORMAT
-	         "  %" G_GUINT64_FORMAT, pushed, lost, late);
+	         "  %" G_GUINT64_FORMAT "  %.0f fps", pushed, lost, late,
+	         mc->stream.fps);
 	gtk_label_set_text(GTK_LABEL(mc->stat_lbl), buf);
 }
 
@@ -391,13 +1180,160 @@ static guint64 pkt_count(guint64 t0, guint64 t1) {
 	return (t0 < t1) ? t1 - t0 : 0;
 }
 
+/* Check if a cell shares a decoder with another cell */
+static bool moncell_is_shared(const struct moncell *mc) {
+	if (mc->stream.primary)
+		return true;
+	for (uint32_t n = 0; n < grid.n_cells; n++) {
+		if (grid.cells[n].stream.primary == &mc->stream)
+			return true;
+	}
+	return false;
+}
+
+/* Check if the governor may degrade a cell.  The selected monitor and a
+ * full-screen cell always keep full quality. */
+static bool moncell_is_governed(const struct moncell *mc) {
+	return grid.n_cells > 1
+	    && mc->started
+	    && !mc->still
+	    && !mc->stream.hidden
+	    && !moncell_is_selected(mc)
+	    && !moncell_is_shared(mc);
+}
+
+static void moncell_degrade(struct moncell *mc, enum degrade level) {
+	elog_err("Degrade %s: %d\n", moncell_get_cam_id(mc), level);
+	stream_set_degrade(&mc->stream, level);
+}
+
+/* Degrade one step: least degraded cell, last cells first */
+static void mongrid_degrade(void) {
+	struct moncell *dc = NULL;
+	for (uint32_t n = grid.n_cells; n > 0; n--) {
+		struct moncell *mc = grid.cells + n - 1;
+		if (moncell_is_governed(mc) &&
+		    mc->stream.degrade < DEGRADE_PAUSE &&
+		    (!dc || mc->stream.degrade < dc->stream.degrade))
+			dc = mc;
+	}
+	if (dc)
+		moncell_degrade(dc, dc->stream.degrade + 1);
+}
+
+/* Recover one step: most degraded cell, first cells first */
+static void mongrid_recover(void) {
+	struct moncell *rc = NULL;
+	for (uint32_t n = 0; n < grid.n_cells; n++) {
+		struct moncell *mc = grid.cells + n;
+		if (mc->stream.degrade > DEGRADE_NONE &&
+		    (!rc || mc->stream.degrade > rc->stream.degrade))
+			rc = mc;
+	}
+	if (rc)
+		moncell_degrade(rc, rc->stream.degrade - 1);
+}
+
+/* Governor step */
+enum gov_step {
+	GOV_HOLD,
+	GOV_DEGRADE,
+	GOV_RECOVER,
+};
+
+/* Estimate load from frames dropped (QoS) by cells at full quality.  Only
+ * frame counts and degrade levels are read, which change on this thread. */
+static enum gov_step mongrid_sample_load(void) {
+	uint32_t frames = 0;
+	uint32_t drops = 0;
+	for (uint32_t n = 0; n < grid.n_cells; n++) {
+		struct moncell *mc = grid.cells + n;
+		if (mc->stream.degrade == DEGRADE_NONE) {
+			frames += MAX(mc->stream.chk_frames, 0);
+			drops += mc->stream.chk_drops;
+		}
+	}
+	double ratio = (frames + drops) ? (double) drops / (frames + drops) : 0;
+	grid.load = (grid.load + ratio) / 2;
+	if (grid.load > GOV_OVERLOAD) {
+		grid.calm = 0;
+		return GOV_DEGRADE;
+	} else if (grid.load < GOV_HEADROOM) {
+		if (++grid.calm >= GOV_CALM) {
+			grid.calm = 0;
+			return GOV_RECOVER;
+		}
+	} else
+		grid.calm = 0;
+	return GOV_HOLD;
+}
+
+/* Check if any cell is degraded */
+static bool mongrid_is_degraded(void) {
+	for (uint32_t n = 0; n < grid.n_cells; n++) {
+		if (grid.cells[n].stream.degrade > DEGRADE_NONE)
+			return true;
+	}
+	return false;
+}
+
+/* Restore cells which are no longer governed, then degrade or recover one
+ * step */
+static void mongrid_govern(enum gov_step step) {
+	for (uint32_t n = 0; n < grid.n_cells; n++) {
+		struct moncell *mc = grid.cells + n;
+		if (mc->stream.degrade > DEGRADE_NONE &&
+		    !moncell_is_governed(mc))
+			moncell_degrade(mc, DEGRADE_NONE);
+	}
+	if (step == GOV_DEGRADE)
+		mongrid_degrade();
+	else if (step == GOV_RECOVER)
+		mongrid_recover();
+}
+
+/* Check if a cell may need a state change.  This runs without the grid lock,
+ * so only flags are read; the checks are repeated with the lock held. */
+static bool moncell_needs_check(struct moncell *mc) {
+	bool stale = mc->started && stream_is_stale(&mc->stream);
+	return mc->renditions
+	    || mc->standby_on
+	    || mc == g_atomic_pointer_get(&grid.selected)
+	    || (grid.window && stale != mc->stale);
+}
+
+static void moncell_check(struct moncell *mc) {
+	moncell_check_rendition(mc);
+	moncell_check_stale(mc);
+	moncell_check_standby(mc);
+}
+
+/* Periodic check.  Cells are only added or removed on this thread while the
+ * main loop is not running, and frame counters are atomic, so sampling runs
+ * without the grid lock.  It is only taken for cells needing a change. */
 static gboolean do_check_sink(gpointer data) {
-	lock_acquire(&grid.lock, __func__);
+	for (uint32_t n = 0; n < grid.n_cells; n++)
+		stream_check_eos(&grid.cells[n].stream);
 	for (uint32_t n = 0; n < grid.n_cells; n++) {
 		struct moncell *mc = grid.cells + n;
-		stream_check_eos(&mc->stream);
+		if (moncell_needs_check(mc)) {
+			lock_acquire(&grid.lock, __func__);
+			moncell_check(mc);
+			lock_release(&grid.lock, __func__);
+		}
+	}
+	/* Sharing may have changed since the last check */
+	if (mongrid_is_hidden_changed()) {
+		lock_acquire(&grid.lock, __func__);
+		mongrid_update_hidden();
+		lock_release(&grid.lock, __func__);
+	}
+	enum gov_step step = mongrid_sample_load();
+	if (step != GOV_HOLD || mongrid_is_degraded()) {
+		lock_acquire(&grid.lock, __func__);
+		mongrid_govern(step);
+		lock_release(&grid.lock, __func__);
 	}
-	lock_release(&grid.lock, __func__);
 	return TRUE;
 }
 
@@ -425,8 +1361,12 @@ void mongrid_create(bool gui, bool stats) {
 	gst_init(NULL, NULL);
 	memset(&grid, 0, sizeof(struct mongrid));
 	lock_init(&grid.lock);
+	idrcache_init();
+	adapt_init();
 	grid.stats = stats;
 	if (gui) {
+		grid.snap_pool = g_thread_pool_new(snap_convert, NULL, 2, FALSE,
+			NULL);
 		gtk_init(NULL, NULL);
 		GtkWidget *window = gtk_window_new(0);
 		grid.window = window;
@@ -445,22 +1385,88 @@ void mongrid_create(bool gui, bool stats) {
 		g_timeout_add(4000, do_stats, NULL);
 }
 
-static void mongrid_init_gtk(uint32_t n_cells) {
-	int n_rows = get_rows(n_cells);
-	int n_cols = get_cols(n_cells);
-	grid.grid = gtk_grid_new();
-	GtkGrid *gr = (GtkGrid *) grid.grid;
-	gtk_grid_set_column_spacing(gr, 4);
-	gtk_grid_set_row_spacing(gr, 4);
+/* Lay out all cells in compositor mode */
+static void mongrid_compose(void) {
+	int width = gtk_widget_get_allocated_width(grid.grid);
+	int height = gtk_widget_get_allocated_height(grid.grid);
+	compositor_set_size(grid.comp, width, height);
+	for (uint32_t n = 0; n < grid.n_cells; n++)
+		moncell_compose(grid.cells + n);
+}
+
+static gboolean do_compose(gpointer data) {
+	lock_acquire(&grid.lock, __func__);
+	if (grid.comp)
+		mongrid_compose();
+	lock_release(&grid.lock, __func__);
+	return FALSE;
+}
+
+static void compose_allocate_cb(GtkWidget *widget, GdkRectangle *alloc,
+	gpointer data)
+{
+	g_timeout_add(0, do_compose, NULL);
+}
+
+static gboolean compose_draw_cb(GtkWidget *widget, cairo_t *cr, gpointer data)
+{
+	guint width = gtk_widget_get_allocated_width(widget);
+	guint height = gtk_widget_get_allocated_height(widget);
+	cairo_rectangle(cr, 0, 0, width, height);
+	cairo_fill(cr);
+	return TRUE;
+}
+
+/* Create one output window for all cells, fed by a compositor */
+static void mongrid_init_compositor(uint32_t n_cells) {
+	grid.comp = compositor_create(n_cells);
+	for (uint32_t n = 0; n < n_cells; n++)
+		moncell_init_compositor(grid.cells + n, n);
+	grid.grid = gtk_drawing_area_new();
+	g_signal_connect(G_OBJECT(grid.grid), "draw",
+		G_CALLBACK(compose_draw_cb), NULL);
+	g_signal_connect(G_OBJECT(grid.grid), "size-allocate",
+		G_CALLBACK(compose_allocate_cb), NULL);
+	gtk_box_pack_end(GTK_BOX(grid.tbox), grid.grid, TRUE, TRUE, 0);
+	gtk_widget_show_all(grid.window);
+	if (!modebar_is_visible(grid.mbar))
+		modebar_hide(grid.mbar);
+	gtk_widget_realize(grid.window);
+	compositor_set_handle(grid.comp, GDK_WINDOW_XID(gtk_widget_get_window(
+		grid.grid)));
+	mongrid_compose();
+	compositor_start(grid.comp);
+}
+
+static GtkWidget *mongrid_create_page(uint32_t page) {
+	GtkWidget *gw = gtk_grid_new();
+	GtkGrid *gr = (GtkGrid *) gw;
+	gtk_grid_set_column_spacing(gr, GRID_GAP);
+	gtk_grid_set_row_spacing(gr, GRID_GAP);
 	gtk_grid_set_column_homogeneous(gr, TRUE);
 	gtk_grid_set_row_homogeneous(gr, TRUE);
-	for (uint32_t r = 0; r < n_rows; r++) {
-		for (uint32_t c = 0; c < n_cols; c++) {
-			uint32_t i = r * n_cols + c;
-			struct moncell *mc = grid.cells + i;
-			gtk_grid_attach(gr, mc->box, c, r, 1, 1);
+	for (uint32_t n = 0; n < grid.n_cells; n++) {
+		struct moncell *mc = grid.cells + n;
+		if (mc->page == page) {
+			gtk_grid_attach(gr, mc->box, mc->pos.col, mc->pos.row,
+				mc->pos.width, mc->pos.height);
 		}
 	}
+	return gw;
+}
+
+/* Create one grid per page; with several pages, they are in a stack */
+static void mongrid_init_gtk(void) {
+	if (grid.n_pages > 1) {
+		grid.grid = gtk_stack_new();
+		for (uint32_t p = 0; p < grid.n_pages; p++) {
+			char name[8];
+			snprintf(name, sizeof(name), "%u", p);
+			gtk_stack_add_named(GTK_STACK(grid.grid),
+				mongrid_create_page(p), name);
+		}
+	} else
+		grid.grid = mongrid_create_page(0);
 	gtk_box_pack_end(GTK_BOX(grid.tbox), GTK_WIDGET(grid.grid),TRUE,TRUE,0);
 	gtk_widget_show_all(grid.window);
 	if (!modebar_is_visible(grid.mbar))
@@ -469,19 +1475,116 @@ static void mongrid_init_gtk(uint32_t n_cells) {
 	mongrid_set_handles();
 }
 
-int32_t mongrid_init(uint32_t num, pthread_t tid, nstr_t sink_name) {
+/* Place a cell in the first free slots of a page, in reading order */
+static bool layout_place(bool used[MAX_SLOTS][MAX_SLOTS], uint32_t rows,
+	uint32_t cols, uint32_t w, uint32_t h, struct cell_pos *pos)
+{
+	for (uint32_t r = 0; r + h <= rows; r++) {
+		for (uint32_t c = 0; c + w <= cols; c++) {
+			bool free = true;
+			for (uint32_t i = 0; free && i < h * w; i++)
+				free = !used[r + i / w][c + i % w];
+			if (free) {
+				for (uint32_t i = 0; i < h * w; i++)
+					used[r + i / w][c + i % w] = true;
+				pos->col = c;
+				pos->row = r;
+				pos->width = w;
+				pos->height = h;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/** Parse a page layout, and place cells on a page.
+ *
+ * A layout is "RxC" (rows x columns), optionally followed by spans
+ * ("WxH", columns x rows) for the first cells of each page.  Remaining slots
+ * are filled with single cells.  For example, "3x3:2x2" is one large cell and
+ * five small ones.
+ * @return Cells per page, or 0 if layout is invalid. */
+static uint32_t layout_parse(const char *layout, struct cell_pos *pos) {
+	bool used[MAX_SLOTS][MAX_SLOTS];
+	unsigned rows, cols, w, h;
+	int n;
+	uint32_t n_pos = 0;
+
+	if (sscanf(layout, "%ux%u%n", &rows, &cols, &n) != 2 || rows < 1 ||
+	    cols < 1 || rows > MAX_SLOTS || cols > MAX_SLOTS)
+		return 0;
+	memset(used, 0, sizeof(used));
+	for (const char *p = layout + n; *p; p += n) {
+		if (*p != ':' && *p != ',')
+			return 0;
+		if (sscanf(p + 1, "%ux%u%n", &w, &h, &n) != 2 || w < 1 ||
+		    h < 1 || !layout_place(used, rows, cols, w, h,
+		    pos + n_pos))
+			return 0;
+		n_pos++;
+		n++;
+	}
+	while (layout_place(used, rows, cols, 1, 1, pos + n_pos))
+		n_pos++;
+	grid.n_rows = rows;
+	grid.n_cols = cols;
+	return n_pos;
+}
+
+/* Lay out a grid for a number of monitors.  Without a layout, up to 16 cells
+ * fit a near-square grid, and more are split into 4x4 pages. */
+static uint32_t mongrid_layout(uint32_t num, nstr_t layout,
+	struct cell_pos *pos)
+{
+	char buf[64];
+	uint32_t per_page = 0;
+	if (nstr_len(layout)) {
+		nstr_to_cstr(buf, sizeof(buf), layout);
+		per_page = layout_parse(buf, pos);
+		if (!per_page)
+			elog_err("Invalid layout: %s\n", buf);
+	}
+	if (!per_page) {
+		uint32_t n = MIN(num, MAX_SQUARE);
+		snprintf(buf, sizeof(buf), "%ux%u", get_rows(n), get_cols(n));
+		per_page = layout_parse(buf, pos);
+	}
+	return per_page;
+}
+
+int32_t mongrid_init(uint32_t num, nstr_t layout, pthread_t tid,
+	nstr_t sink_name)
+{
+	struct cell_pos pos[MAX_PAGE_CELLS];
 	lock_acquire(&grid.lock, __func__);
-	if (num > 16) {
+	uint32_t per_page = mongrid_layout(num, layout, pos);
+	grid.n_pages = (num + per_page - 1) / per_page;
+	grid.page = 0;
+	bool comp = grid.window && nstr_cmp_z(sink_name, "COMPOSITOR");
+	if (num > MAX_CELLS || (comp && grid.n_pages > 1)) {
 		grid.n_cells = 0;
 		elog_err("Grid too large: %d\n", num);
 		goto err;
 	}
-	grid.n_cells = get_rows(num) * get_cols(num);
+	grid.n_cells = grid.n_pages * per_page;
 	grid.cells = calloc(grid.n_cells, sizeof(struct moncell));
-	for (uint32_t n = 0; n < grid.n_cells; n++)
-		moncell_init(grid.cells + n, n, sink_name);
+	grid.load = 0;
+	grid.calm = 0;
+	for (uint32_t n = 0; n < grid.n_cells; n++) {
+		struct moncell *mc = grid.cells + n;
+		moncell_init(mc, n, sink_name);
+		mc->page = n / per_page;
+		mc->pos = pos[n % per_page];
+		/* Cells on other pages are never mapped until shown */
+		mc->hidden = (mc->page != grid.page);
+	}
+	mongrid_update_hidden();
 	if (grid.window) {
-		mongrid_init_gtk(grid.n_cells);
+		if (comp)
+			mongrid_init_compositor(grid.n_cells);
+		else
+			mongrid_init_gtk();
 		modebar_set_tid(grid.mbar, tid);
 	}
 	grid.running = false;
@@ -521,8 +1624,19 @@ void mongrid_restart(void) {
 
 void mongrid_reset(void) {
 	lock_acquire(&grid.lock, __func__);
+	/* Detach shared decoder branches before any pipeline is destroyed */
+	for (uint32_t n = 0; n < grid.n_cells; n++) {
+		struct moncell *mc = grid.cells + n;
+		if (mc->stream.primary)
+			stream_stop(&mc->stream);
+	}
 	for (uint32_t n = 0; n < grid.n_cells; n++)
 		moncell_destroy(grid.cells + n);
+	if (grid.comp) {
+		compositor_destroy(grid.comp);
+		grid.comp = NULL;
+	}
+	g_atomic_pointer_set(&grid.selected, NULL);
 	free(grid.cells);
 	grid.cells = NULL;
 	grid.n_cells = 0;
@@ -535,33 +1649,40 @@ void mongrid_reset(void) {
 
 void mongrid_set_mon(uint32_t idx, nstr_t mid, int32_t accent, bool aspect,
 	uint32_t font_sz, nstr_t crop, uint32_t hgap, uint32_t vgap,
-	nstr_t extra)
+	nstr_t extra, bool key_only)
 {
 	lock_acquire(&grid.lock, __func__);
 	if (idx < grid.n_cells) {
 		struct moncell *mc = grid.cells + idx;
 		moncell_set_mon(mc, mid, accent, aspect, font_sz, crop, hgap,
-			vgap, extra);
+			vgap, extra, key_only);
+		mongrid_update_selected();
 	}
 	lock_release(&grid.lock, __func__);
 }
 
 void mongrid_play_stream(uint32_t idx, nstr_t cam_id, nstr_t loc, nstr_t desc,
-	nstr_t encoding, uint32_t latency, nstr_t sprops)
+	nstr_t encoding, uint32_t latency, nstr_t sprops, bool low_latency,
+	nstr_t fallback, nstr_t fb_sprops)
 {
 	lock_acquire(&grid.lock, __func__);
 	if (idx < grid.n_cells) {
 		struct moncell *mc = grid.cells + idx;
 		moncell_play_stream(mc, cam_id, loc, desc, encoding, latency,
-			sprops);
+			sprops, low_latency, fallback, fb_sprops);
 	}
 	lock_release(&grid.lock, __func__);
 }
 
 void mongrid_destroy(void) {
 	mongrid_reset();
+	/* Wait for a running snapshot; queued ones are dropped */
+	if (grid.snap_pool)
+		g_thread_pool_free(grid.snap_pool, TRUE, TRUE);
 	if (grid.window)
 		gtk_widget_destroy(grid.window);
+	adapt_destroy();
+	idrcache_destroy();
 	lock_destroy(&grid.lock);
 	memset(&grid, 0, sizeof(struct mongrid));
 }
@@ -595,6 +1716,65 @@ nstr_t mongrid_status(nstr_t str) {
 	return str;
 }
 
+/* Copy a string for JSON, escaping quotes and backslashes */
+static void json_str(char *dst, size_t n, const char *src) {
+	size_t i = 0;
+	for (; *src && i + 2 < n; src++) {
+		if (*src == '"' || *src == '\\')
+			dst[i++] = '\\';
+		if ((unsigned char) *src >= ' ')
+			dst[i++] = *src;
+	}
+	dst[i] = '\0';
+}
+
+static nstr_t moncell_metrics(struct moncell *mc, nstr_t str, uint32_t idx,
+	bool json)
+{
+	char buf[1024];
+	char mid[24];
+	char cam[48];
+	int len;
+
+	if (json) {
+		json_str(mid, sizeof(mid), mc->mid);
+		json_str(cam, sizeof(cam), moncell_get_cam_id(mc));
+		len = snprintf(buf, sizeof(buf), "%s{\"idx\":%u,\"mon\":\"%s\","
+			"\"cam\":\"%s\",\"started\":%s,\"failed\":%s,"
+			"\"stream\":", (idx) ? "," : "", idx, mid, cam,
+			(mc->started) ? "true" : "false",
+			(mc->failed) ? "true" : "false");
+		len += stream_metrics_json(&mc->stream, buf + len,
+			sizeof(buf) - len);
+		snprintf(buf + MIN(len, sizeof(buf)), sizeof(buf) - MIN(len,
+			sizeof(buf)), "}");
+	} else {
+		len = snprintf(buf, sizeof(buf), "cell %u mon %s cam %s "
+			"state %s %s", idx, mc->mid, moncell_get_cam_id(mc),
+			stream_state(&mc->stream),
+			(mc->failed) ? "failed " : "");
+		len += stream_metrics(&mc->stream, buf + len,
+			sizeof(buf) - len);
+		snprintf(buf + MIN(len, sizeof(buf)), sizeof(buf) - MIN(len,
+			sizeof(buf)), "\n");
+	}
+	nstr_cat_z(&str, buf);
+	return str;
+}
+
+/** Get metrics of all cells, as text lines or a JSON array */
+nstr_t mongrid_metrics(nstr_t str, bool json) {
+	lock_acquire(&grid.lock, __func__);
+	if (json)
+		nstr_cat_z(&str, "[");
+	for (uint32_t n = 0; n < grid.n_cells; n++)
+		str = moncell_metrics(grid.cells + n, str, n, json);
+	if (json)
+		nstr_cat_z(&str, "]");
+	lock_release(&grid.lock, __func__);
+	return str;
+}
+
 bool mongrid_mon_selected(void) {
 	return (grid.mbar) && modebar_has_mon(grid.mbar);
 }
@@ -603,6 +1783,7 @@ void mongrid_display(nstr_t mon, nstr_t cam, nstr_t seq) {
 	if (grid.mbar) {
 		lock_acquire(&grid.lock, __func__);
 		modebar_display(grid.mbar, mon, cam, seq);
+		mongrid_update_selected();
 		lock_release(&grid.lock, __func__);
 	}
 }
@@ -621,6 +1802,7 @@ bool mongrid_joy_event(int fd) {
 		if (n_bytes == sizeof(ev)) {
 			lock_acquire(&grid.lock, __func__);
 			modebar_joy_event(grid.mbar, &ev);
+			mongrid_update_selected();
 			lock_release(&grid.lock, __func__);
 		}
 		return true;
@@ -628,6 +1810,36 @@ bool mongrid_joy_event(int fd) {
 		return false;
 }
 
+static gboolean do_show_page(gpointer data) {
+	char name[8];
+	lock_acquire(&grid.lock, __func__);
+	snprintf(name, sizeof(name), "%u", grid.page);
+	if (grid.grid && grid.n_pages > 1)
+		gtk_stack_set_visible_child_name(GTK_STACK(grid.grid), name);
+	lock_release(&grid.lock, __func__);
+	return FALSE;
+}
+
+/** Show a page of the grid.  Cells on other pages are unmapped, which hides
+ * their streams (see visibility_cb). */
+void mongrid_set_page(uint32_t page) {
+	lock_acquire(&grid.lock, __func__);
+	if (page < grid.n_pages && page != grid.page) {
+		grid.page = page;
+		if (grid.window)
+			g_timeout_add(0, do_show_page, NULL);
+		else {
+			for (uint32_t n = 0; n < grid.n_cells; n++) {
+				struct moncell *mc = grid.cells + n;
+				mc->hidden = (mc->page != page);
+			}
+			mongrid_update_hidden();
+		}
+	} else if (page >= grid.n_pages)
+		elog_err("Invalid page: %u\n", page);
+	lock_release(&grid.lock, __func__);
+}
+
 void mongrid_set_online(bool online) {
 	if (grid.mbar) {
 		lock_acquire(&grid.lock, __func__);
@@ -4,20 +4,24 @@
 #include "nstr.h"
 
 void mongrid_create(bool gui, bool stats);
-int32_t mongrid_init(uint32_t num, pthread_t tid, nstr_t sink_name);
+int32_t mongrid_init(uint32_t num, nstr_t layout, pthread_t tid,
+	nstr_t sink_name);
 void mongrid_run(void);
 void mongrid_restart(void);
 void mongrid_reset(void);
 void mongrid_destroy(void);
 void mongrid_set_mon(uint32_t idx, nstr_t mid, uint32_t accent, bool aspect,
 	uint32_t font_sz, nstr_t crop, uint32_t hgap, uint32_t vgap,
-	nstr_t extra);
+	nstr_t extra, bool key_only);
 void mongrid_play_stream(uint32_t idx, nstr_t cam_id, nstr_t loc, nstr_t desc,
-	nstr_t encoding, uint32_t latency, nstr_t sprops);
+	nstr_t encoding, uint32_t latency, nstr_t sprops, bool low_latency,
+	nstr_t fallback, nstr_t fb_sprops);
 bool mongrid_mon_selected(void);
 nstr_t mongrid_status(nstr_t str);
+nstr_t mongrid_metrics(nstr_t str, bool json);
 void mongrid_display(nstr_t mon, nstr_t cam, nstr_t seq);
 bool mongrid_joy_event(int fd);
+void mongrid_set_page(uint32_t page);
 void mongrid_set_online(bool online);
 
 #endif
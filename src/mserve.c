@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2026  Minnesota Department of Transportation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>		/* for socket stuff */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "elog.h"
+#include "lock.h"
+#include "metrics.h"
+#include "mongrid.h"
+#include "mserve.h"
+#include "nstr.h"
+
+/*
+ * Metrics server: a minimal HTTP/1.0 server on the loopback interface.
+ *
+ *   GET /metrics       per-cell metrics, one text line per cell
+ *   GET /metrics.json  same, as JSON (with command timings)
+ */
+
+#define BODY_LEN	(256 * 1024)
+#define BIND_TRIES	(8)	/* with backoff: about 2 minutes */
+
+/* Command processing timings */
+static struct lock _lock;
+static struct metric_ring _cmd_ms;
+static uint64_t _n_cmds;
+
+void mserve_init(void) {
+	lock_init(&_lock);
+	memset(&_cmd_ms, 0, sizeof(_cmd_ms));
+	_n_cmds = 0;
+}
+
+void mserve_destroy(void) {
+	lock_destroy(&_lock);
+}
+
+/** Record time to process one command (ms) */
+void mserve_cmd_time(double ms) {
+	lock_acquire(&_lock, __func__);
+	metric_ring_push(&_cmd_ms, ms);
+	_n_cmds++;
+	lock_release(&_lock, __func__);
+}
+
+static nstr_t mserve_cmds(nstr_t str, bool json) {
+	struct metric_summary ms;
+	char buf[128];
+	uint64_t n_cmds;
+
+	lock_acquire(&_lock, __func__);
+	metric_ring_summary(&_cmd_ms, &ms);
+	n_cmds = _n_cmds;
+	lock_release(&_lock, __func__);
+	if (json) {
+		snprintf(buf, sizeof(buf), "{\"count\":%" PRIu64 ",\"ms\":"
+			"{\"min\":%.2f,\"avg\":%.2f,\"p99\":%.2f}}", n_cmds,
+			ms.min, ms.avg, ms.p99);
+	} else {
+		snprintf(buf, sizeof(buf), "commands %" PRIu64
+			" ms %.2f/%.2f/%.2f\n", n_cmds, ms.min, ms.avg, ms.p99);
+	}
+	nstr_cat_z(&str, buf);
+	return str;
+}
+
+static nstr_t mserve_body(nstr_t str, bool json) {
+	if (json) {
+		nstr_cat_z(&str, "{\"cells\":");
+		str = mongrid_metrics(str, true);
+		nstr_cat_z(&str, ",\"commands\":");
+		str = mserve_cmds(str, true);
+		nstr_cat_z(&str, "}\n");
+	} else {
+		str = mongrid_metrics(str, false);
+		str = mserve_cmds(str, false);
+	}
+	return str;
+}
+
+static int mserve_bind(const char *service) {
+	struct addrinfo hints;
+	struct addrinfo *rai = NULL;
+	int fd = -1;
+	int on = 1;
+	int rc;
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	rc = getaddrinfo("127.0.0.1", service, &hints, &rai);
+	if (rc) {
+		elog_err("getaddrinfo: %s\n", gai_strerror(rc));
+		return -1;
+	}
+	fd = socket(rai->ai_family, rai->ai_socktype, rai->ai_protocol);
+	if (fd < 0) {
+		elog_err("socket: %s\n", strerror(errno));
+		goto out;
+	}
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0)
+		elog_err("setsockopt: %s\n", strerror(errno));
+	if (bind(fd, rai->ai_addr, rai->ai_addrlen) != 0 ||
+	    listen(fd, 4) != 0)
+	{
+		elog_err("bind: %s\n", strerror(errno));
+		close(fd);
+		fd = -1;
+	}
+out:
+	freeaddrinfo(rai);
+	return fd;
+}
+
+/* Send all bytes; a client which has gone away must not raise SIGPIPE */
+static bool mserve_write(int fd, const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+static void mserve_send(int fd, const char *status, const char *ctype,
+	nstr_t body)
+{
+	char head[160];
+	int n = snprintf(head, sizeof(head), "HTTP/1.0 %s\r\n"
+		"Content-Type: %s\r\n"
+		"Content-Length: %u\r\n"
+		"Connection: close\r\n\r\n", status, ctype, nstr_len(body));
+	if (!mserve_write(fd, head, n) ||
+	    !mserve_write(fd, body.buf, body.len))
+		elog_err("metrics write: %s\n", strerror(errno));
+}
+
+static void mserve_request(int fd, char *body) {
+	char buf[512];
+	struct timeval tv = { .tv_sec = 2, .tv_usec = 0 };
+	nstr_t str = nstr_init(body, BODY_LEN);
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	ssize_t n = read(fd, buf, sizeof(buf) - 1);
+	if (n <= 0)
+		return;
+	buf[n] = '\0';
+	if (strncmp(buf, "GET /metrics.json ", 18) == 0) {
+		str = mserve_body(str, true);
+		mserve_send(fd, "200 OK", "application/json", str);
+	} else if (strncmp(buf, "GET /metrics ", 13) == 0 ||
+	           strncmp(buf, "GET / ", 6) == 0)
+	{
+		str = mserve_body(str, false);
+		mserve_send(fd, "200 OK", "text/plain", str);
+	} else {
+		nstr_cat_z(&str, "Not found\n");
+		mserve_send(fd, "404 Not Found", "text/plain", str);
+	}
+}
+
+/** Serve metrics requests on a loopback TCP port.
+ *
+ * Binding is retried with backoff; only returns if the port cannot be bound. */
+void mserve_run(const char *port) {
+	int fd;
+	unsigned delay = 1;
+	char *body = malloc(BODY_LEN);
+	if (!body)
+		return;
+	for (int i = 1; (fd = mserve_bind(port)) < 0; i++) {
+		if (i >= BIND_TRIES) {
+			elog_err("metrics: cannot bind port %s; disabled\n",
+				port);
+			free(body);
+			return;
+		}
+		sleep(delay);
+		delay *= 2;
+	}
+	while (true) {
+		int cfd = accept(fd, NULL, NULL);
+		if (cfd >= 0) {
+			mserve_request(cfd, body);
+			close(cfd);
+		} else
+			elog_err("accept: %s\n", strerror(errno));
+	}
+}
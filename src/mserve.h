@@ -0,0 +1,9 @@
+#ifndef MSERVE_H
+#define MSERVE_H
+
+void mserve_init(void);
+void mserve_destroy(void);
+void mserve_cmd_time(double ms);
+void mserve_run(const char *port);
+
+#endif
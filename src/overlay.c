@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2026  Minnesota Department of Transportation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <gst/video/video.h>
+#include <pango/pangocairo.h>
+#include "lock.h"
+#include "overlay.h"
+
+/*
+ * Description overlay.  Text is rendered once into an ARGB overlay
+ * composition, which is cached until the text, font size, frame size or
+ * display size changes.  A pad probe attaches the composition to each frame
+ * as a meta when the sink can blend it; otherwise the probe blends it.
+ * Unlike textoverlay, frames without timestamps (MJPEG) are fine.
+ *
+ * When videocrop passes a crop meta instead of cropping (xvimagesink), caps
+ * describe the cropped area, but buffers hold the full frame, so the text is
+ * placed within the crop rectangle.
+ */
+
+#define TEXT_COLOR	(0xFFFFFFE0)	/* ARGB */
+#define TEXT_XPAD	(48)		/* display pixels */
+#define TEXT_YPAD	(36)
+
+struct overlay {
+	struct lock	lock;
+	char		text[64];
+	uint32_t	font_sz;
+	gint		disp_height;     /* display height (0 if unknown) */
+	GstVideoInfo	info;            /* negotiated video info */
+	bool		has_info;
+	bool		use_meta;        /* downstream blends composition */
+	bool		dirty;           /* composition must be rendered */
+	GstVideoRectangle crop;          /* visible area (w 0 if not cropped) */
+	GstVideoOverlayComposition *comp;
+};
+
+static void overlay_clear(struct overlay *ov) {
+	if (ov->comp) {
+		gst_video_overlay_composition_unref(ov->comp);
+		ov->comp = NULL;
+	}
+	ov->dirty = true;
+}
+
+static void overlay_destroy(gpointer data) {
+	struct overlay *ov = data;
+	overlay_clear(ov);
+	lock_destroy(&ov->lock);
+	g_free(ov);
+}
+
+/** Set description text, font size (pt) and display height (pixels) */
+void overlay_set_text(struct overlay *ov, const char *text, uint32_t font_sz,
+	gint disp_height)
+{
+	lock_acquire(&ov->lock, __func__);
+	if (strcmp(ov->text, text) != 0 || ov->font_sz != font_sz ||
+	    ov->disp_height != disp_height)
+	{
+		snprintf(ov->text, sizeof(ov->text), "%s", text);
+		ov->font_sz = font_sz;
+		ov->disp_height = disp_height;
+		overlay_clear(ov);
+	}
+	lock_release(&ov->lock, __func__);
+}
+
+/* Get scale from display to frame pixels */
+static double overlay_scale(const struct overlay *ov) {
+	gint height = GST_VIDEO_INFO_HEIGHT(&ov->info);
+	return (ov->disp_height > 0 && height > 0)
+	      ? (double) height / ov->disp_height
+	      : 1;
+}
+
+static PangoLayout *overlay_layout(const struct overlay *ov, cairo_t *cr) {
+	char font[32];
+	PangoLayout *layout = pango_cairo_create_layout(cr);
+	snprintf(font, sizeof(font), "Overpass, Bold %d",
+		(int) (ov->font_sz * overlay_scale(ov) + 0.5));
+	PangoFontDescription *desc = pango_font_description_from_string(font);
+	pango_layout_set_font_description(layout, desc);
+	pango_font_description_free(desc);
+	pango_layout_set_text(layout, ov->text, -1);
+	return layout;
+}
+
+/* Render text into a premultiplied ARGB buffer */
+static GstBuffer *overlay_render(const struct overlay *ov, int *w, int *h) {
+	cairo_surface_t *surf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+		1, 1);
+	cairo_t *cr = cairo_create(surf);
+	PangoLayout *layout = overlay_layout(ov, cr);
+	pango_layout_get_pixel_size(layout, w, h);
+	g_object_unref(layout);
+	cairo_destroy(cr);
+	cairo_surface_destroy(surf);
+	if (*w <= 0 || *h <= 0)
+		return NULL;
+	surf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, *w, *h);
+	cr = cairo_create(surf);
+	cairo_set_source_rgba(cr, ((TEXT_COLOR >> 16) & 0xFF) / 255.0,
+		((TEXT_COLOR >> 8) & 0xFF) / 255.0, (TEXT_COLOR & 0xFF) / 255.0,
+		((TEXT_COLOR >> 24) & 0xFF) / 255.0);
+	layout = overlay_layout(ov, cr);
+	pango_cairo_show_layout(cr, layout);
+	g_object_unref(layout);
+	cairo_destroy(cr);
+	cairo_surface_flush(surf);
+	/* ARGB32 stride is always width * 4 */
+	gsize n_bytes = (gsize) *w * *h * 4;
+	GstBuffer *buf = gst_buffer_new_memdup(
+		cairo_image_surface_get_data(surf), n_bytes);
+	cairo_surface_destroy(surf);
+	gst_buffer_add_video_meta(buf, GST_VIDEO_FRAME_FLAG_NONE,
+		GST_VIDEO_OVERLAY_COMPOSITION_FORMAT_RGB, *w, *h);
+	return buf;
+}
+
+/* Render composition: top right, as textoverlay was configured */
+static void overlay_compose(struct overlay *ov) {
+	int w, h;
+	ov->dirty = false;
+	if (!ov->has_info || !ov->text[0])
+		return;
+	GstBuffer *buf = overlay_render(ov, &w, &h);
+	if (buf) {
+		double scale = overlay_scale(ov);
+		int right = (ov->crop.w > 0)
+		          ? ov->crop.x + ov->crop.w
+		          : GST_VIDEO_INFO_WIDTH(&ov->info);
+		int x = right - w - TEXT_XPAD * scale;
+		int y = ov->crop.y + TEXT_YPAD * scale;
+		GstVideoOverlayRectangle *rect =
+			gst_video_overlay_rectangle_new_raw(buf,
+			MAX(x, ov->crop.x), y, w, h,
+			GST_VIDEO_OVERLAY_FORMAT_FLAG_PREMULTIPLIED_ALPHA);
+		ov->comp = gst_video_overlay_composition_new(rect);
+		gst_video_overlay_rectangle_unref(rect);
+		gst_buffer_unref(buf);
+	}
+}
+
+/* Update crop rectangle from a buffer's crop meta */
+static void overlay_set_crop(struct overlay *ov, GstBuffer *buf) {
+	GstVideoCropMeta *cm = gst_buffer_get_video_crop_meta(buf);
+	GstVideoRectangle crop = { 0, 0, 0, 0 };
+	if (cm) {
+		crop.x = cm->x;
+		crop.y = cm->y;
+		crop.w = cm->width;
+		crop.h = cm->height;
+	}
+	if (memcmp(&crop, &ov->crop, sizeof(crop)) != 0) {
+		ov->crop = crop;
+		overlay_clear(ov);
+	}
+}
+
+/* Get cached composition, rendering it if needed */
+static GstVideoOverlayComposition *overlay_get(struct overlay *ov,
+	GstBuffer *buf, bool *use_meta)
+{
+	GstVideoOverlayComposition *comp = NULL;
+	lock_acquire(&ov->lock, __func__);
+	overlay_set_crop(ov, buf);
+	if (ov->dirty)
+		overlay_compose(ov);
+	if (ov->comp)
+		comp = gst_video_overlay_composition_ref(ov->comp);
+	*use_meta = ov->use_meta;
+	lock_release(&ov->lock, __func__);
+	return comp;
+}
+
+/* Check if downstream can blend an overlay composition meta */
+static bool overlay_query_meta(GstPad *pad, GstCaps *caps) {
+	bool meta = false;
+	GstQuery *q = gst_query_new_allocation(caps, FALSE);
+	if (gst_pad_peer_query(pad, q)) {
+		meta = gst_query_find_allocation_meta(q,
+			GST_VIDEO_OVERLAY_COMPOSITION_META_API_TYPE, NULL);
+	}
+	gst_query_unref(q);
+	return meta;
+}
+
+static void overlay_caps(struct overlay *ov, GstPad *pad, GstCaps *caps) {
+	bool meta = overlay_query_meta(pad, caps);
+	lock_acquire(&ov->lock, __func__);
+	ov->has_info = gst_video_info_from_caps(&ov->info, caps);
+	ov->use_meta = meta;
+	overlay_clear(ov);
+	lock_release(&ov->lock, __func__);
+}
+
+/* Blend composition into frame.  With a crop meta, videocrop also attached a
+ * video meta, so the full frame is mapped. */
+static GstBuffer *overlay_blend(struct overlay *ov, GstBuffer *buf,
+	GstVideoOverlayComposition *comp)
+{
+	GstVideoFrame frame;
+	buf = gst_buffer_make_writable(buf);
+	if (gst_video_frame_map(&frame, &ov->info, buf, GST_MAP_READWRITE)) {
+		gst_video_overlay_composition_blend(comp, &frame);
+		gst_video_frame_unmap(&frame);
+	}
+	return buf;
+}
+
+static GstPadProbeReturn overlay_probe_cb(GstPad *pad, GstPadProbeInfo *info,
+	gpointer user_data)
+{
+	struct overlay *ov = user_data;
+	if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+		GstEvent *ev = GST_PAD_PROBE_INFO_EVENT(info);
+		if (GST_EVENT_TYPE(ev) == GST_EVENT_CAPS) {
+			GstCaps *caps;
+			gst_event_parse_caps(ev, &caps);
+			overlay_caps(ov, pad, caps);
+		}
+	} else if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+		bool use_meta;
+		GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+		GstVideoOverlayComposition *comp = overlay_get(ov, buf,
+			&use_meta);
+		if (comp) {
+			if (use_meta) {
+				/* Only metadata is copied */
+				buf = gst_buffer_make_writable(buf);
+				gst_buffer_add_video_overlay_composition_meta(
+					buf, comp);
+			} else
+				buf = overlay_blend(ov, buf, comp);
+			GST_PAD_PROBE_INFO_DATA(info) = buf;
+			gst_video_overlay_composition_unref(comp);
+		}
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+/** Add an overlay on the src pad of an element.
+ *
+ * The overlay is owned by its probe, and freed with the pad.
+ * @return Overlay, or NULL. */
+struct overlay *overlay_add(GstElement *elem) {
+	struct overlay *ov = NULL;
+	GstPad *pad = gst_element_get_static_pad(elem, "src");
+	if (pad) {
+		ov = g_malloc0(sizeof(struct overlay));
+		lock_init(&ov->lock);
+		ov->dirty = true;
+		gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER |
+			GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, overlay_probe_cb,
+			ov, overlay_destroy);
+		gst_object_unref(pad);
+	}
+	return ov;
+}
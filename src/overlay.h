@@ -0,0 +1,13 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <stdint.h>
+#include <gst/gst.h>
+
+struct overlay;
+
+struct overlay *overlay_add(GstElement *elem);
+void overlay_set_text(struct overlay *ov, const char *text, uint32_t font_sz,
+	gint disp_height);
+
+#endif
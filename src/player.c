@@ -31,13 +31,16 @@
 #include "config.h"
 #include "mongrid.h"
 #include "cxn.h"
+#include "mserve.h"
 
 struct player {
 	struct cxn *cxn;
 	const char *port;
+	const char *metrics_port;
 	pthread_t  cmd_tid;
 	pthread_t  stat_tid;
 	pthread_t  joy_tid;
+	pthread_t  metrics_tid;
 	bool       configuring; // does this need a mutex?
 };
 
@@ -86,34 +89,54 @@ static void player_play(struct player *plyr, nstr_t cmd, bool store) {
 	nstr_t encoding = nstr_split(&str, UNIT_SEP);   // encoding
 	nstr_t desc     = nstr_split(&str, UNIT_SEP);   // title
 	nstr_t lat      = nstr_split(&str, UNIT_SEP);   // latency
+	nstr_t profile  = nstr_split(&str, UNIT_SEP);   // profile
+	nstr_t fallback = nstr_split(&str, UNIT_SEP);   // fallback URI
 	nstr_t sprops   = nstr_init_empty();
+	nstr_t fb_sprops = nstr_init_empty();
 	assert(nstr_cmp_z(play, "play"));
 	int mon = nstr_parse_u32(mdx);
 	if (mon >= 0) {
 		struct sdp_data sdp;
+		struct sdp_data fb_sdp;
 		uint32_t latency = parse_latency(lat);
+		bool low = nstr_cmp_z(profile, "LOW");
 		elog_cmd(cmd);
 		sdp_data_init(&sdp, loc);
 		if (sdp_data_cache(&sdp)) {
 			loc = sdp.udp;
 			sprops = sdp.sprops;
 		}
+		/* Fallback is resolved the same way */
+		sdp_data_init(&fb_sdp, fallback);
+		if (sdp_data_cache(&fb_sdp)) {
+			fallback = fb_sdp.udp;
+			fb_sprops = fb_sdp.sprops;
+		}
 		if (plyr->configuring) {
 			elog_err("cannot play while in config mode\n");
 		} else {
 			mongrid_play_stream(mon, cam_id, loc, desc, encoding,
-				latency, sprops);
+				latency, sprops, low, fallback, fb_sprops);
 		}
 		if (store) {
 			char fname[16];
 			sprintf(fname, "play.%d", mon);
 			config_store(fname, cmd);
 		}
+		bool fetched = false;
 		if (store && sdp_data_fetch(&sdp)) {
 			loc = sdp.udp;
 			sprops = sdp.sprops;
+			fetched = true;
+		}
+		if (store && sdp_data_fetch(&fb_sdp)) {
+			fallback = fb_sdp.udp;
+			fb_sprops = fb_sdp.sprops;
+			fetched = true;
+		}
+		if (fetched) {
 			mongrid_play_stream(mon, cam_id, loc, desc, encoding,
-				latency, sprops);
+				latency, sprops, low, fallback, fb_sprops);
 		}
 	} else
 		elog_err("Invalid monitor: %s\n", nstr_z(cmd));
@@ -131,6 +154,7 @@ static void player_monitor(struct player *plyr, nstr_t cmd, bool store) {
 	nstr_t hg      = nstr_split(&str, UNIT_SEP);    // horizontal gap
 	nstr_t vg      = nstr_split(&str, UNIT_SEP);    // vertical gap
 	nstr_t extra   = nstr_split(&str, UNIT_SEP);    // extra mon
+	nstr_t mode    = nstr_split(&str, UNIT_SEP);    // decode mode
 	assert(nstr_cmp_z(monitor, "monitor"));
 	int mon = nstr_parse_u32(mdx);
 	if (mon >= 0) {
@@ -141,8 +165,9 @@ static void player_monitor(struct player *plyr, nstr_t cmd, bool store) {
 			uint32_t font_sz = parse_font_sz(sz);
 			uint32_t hgap = nstr_parse_u32(hg);
 			uint32_t vgap = nstr_parse_u32(vg);
+			bool key_only = nstr_cmp_z(mode, "KEYFRAMES");
 			mongrid_set_mon(mon, mid, accent, aspect, font_sz, crop,
-				hgap, vgap, extra);
+				hgap, vgap, extra, key_only);
 		}
 		if (store) {
 			char fname[16];
@@ -171,6 +196,19 @@ static void player_config(struct player *plyr, nstr_t cmd) {
 		elog_err("Invalid config: %s\n", nstr_z(cmd));
 }
 
+static void player_page(struct player *plyr, nstr_t cmd) {
+	nstr_t str  = cmd;
+	nstr_t page = nstr_split(&str, UNIT_SEP);	// "page"
+	nstr_t pdx  = nstr_split(&str, UNIT_SEP);	// page index
+	assert(nstr_cmp_z(page, "page"));
+	int p = nstr_parse_u32(pdx);
+	if (p >= 0) {
+		elog_cmd(cmd);
+		mongrid_set_page(p);
+	} else
+		elog_err("Invalid page: %s\n", nstr_z(cmd));
+}
+
 static void player_sink(struct player *plyr, nstr_t cmd) {
 	nstr_t str  = cmd;
 	nstr_t sink = nstr_split(&str, UNIT_SEP);	// "sink"
@@ -191,15 +229,27 @@ static void player_proc_cmd(struct player *plyr, nstr_t cmd, bool store) {
 		player_monitor(plyr, cmd, store);
 	else if (nstr_cmp_z(p1, "config"))
 		player_config(plyr, cmd);
+	else if (nstr_cmp_z(p1, "page"))
+		player_page(plyr, cmd);
 	else if (nstr_cmp_z(p1, "sink"))
 		player_sink(plyr, cmd);
 	else
 		elog_err("Invalid command: %s\n", nstr_z(cmd));
 }
 
+static double elapsed_ms(const struct timespec *t0) {
+	struct timespec t1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1000.0 +
+	       (t1.tv_nsec - t0->tv_nsec) / 1000000.0;
+}
+
 static void player_proc_cmds(struct player *plyr, nstr_t str, bool store) {
 	while (nstr_len(str)) {
+		struct timespec t0;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
 		player_proc_cmd(plyr, nstr_split(&str, RECORD_SEP), store);
+		mserve_cmd_time(elapsed_ms(&t0));
 	}
 }
 
@@ -220,7 +270,7 @@ static void *cmd_thread(void *arg) {
 }
 
 static bool player_send_status(struct player *plyr) {
-	char buf[256];
+	char buf[8192];
 
 	nstr_t str = nstr_init(buf, sizeof(buf));
 	str = mongrid_status(str);
@@ -266,6 +316,13 @@ static void process_joystick(void) {
 		elog_err("Open %s: %s\n", JOY_PATH, strerror(errno));
 }
 
+static void *metrics_thread(void *arg) {
+	struct player *plyr = arg;
+
+	mserve_run(plyr->metrics_port);
+	return NULL;
+}
+
 static void *joy_thread(void *arg) {
 	while (true) {
 		process_joystick();
@@ -303,6 +360,19 @@ static uint32_t load_config(void) {
 	return 1;
 }
 
+static nstr_t load_layout(nstr_t str) {
+	str = config_load("config", str);
+	if (nstr_len(str)) {
+		nstr_t cmd = nstr_chop(str, RECORD_SEP);
+		nstr_t p1 = nstr_split(&cmd, UNIT_SEP);
+		if (nstr_cmp_z(p1, "config")) {
+			nstr_split(&cmd, UNIT_SEP);	// mon count
+			return nstr_split(&cmd, UNIT_SEP);
+		}
+	}
+	return nstr_init_empty();
+}
+
 static nstr_t load_sink(nstr_t str) {
 	str = config_load("sink", str);
 	if (nstr_len(str)) {
@@ -318,9 +388,13 @@ static nstr_t load_sink(nstr_t str) {
 }
 
 static void player_load_cmd(struct player *plyr, const char *fname) {
-	char buf[128];
-	nstr_t str = nstr_init(buf, sizeof(buf));
-	player_proc_cmds(plyr, config_load(fname, str), false);
+	char buf[1024];
+	nstr_t str = config_load(fname, nstr_init(buf, sizeof(buf)));
+	/* A full buffer may have been truncated */
+	if (nstr_len(str) < sizeof(buf))
+		player_proc_cmds(plyr, str, false);
+	else
+		elog_err("Stored command too long: %s\n", fname);
 }
 
 static void player_load_cmds(struct player *plyr, uint32_t mon) {
@@ -345,25 +419,33 @@ static void player_install_handler(struct player *plyr) {
 	sigaction(SIGUSR1, &sa, NULL);
 }
 
-void run_player(bool gui, bool stats, const char *port) {
+void run_player(bool gui, bool stats, const char *port,
+	const char *metrics_port)
+{
 	struct player plyr;
 
 	memset(&plyr, 0, sizeof(struct player));
 	plyr.port = port;
+	plyr.metrics_port = metrics_port;
 	config_init();
+	mserve_init();
 	plyr.cxn = cxn_create();
 	mongrid_create(gui, stats);
 	plyr.cmd_tid = player_create_thread(&plyr, cmd_thread);
 	plyr.stat_tid = player_create_thread(&plyr, status_thread);
 	plyr.joy_tid = player_create_thread(&plyr, joy_thread);
+	if (metrics_port)
+		plyr.metrics_tid = player_create_thread(&plyr, metrics_thread);
 	plyr.configuring = false;
 	player_install_handler(&plyr);
 	while (plyr.cmd_tid && plyr.stat_tid && plyr.joy_tid) {
 		uint32_t mon = load_config();
-		char buf[16];
+		char buf[32];
 		nstr_t str = nstr_init(buf, sizeof(buf));
 		nstr_t sink_name = load_sink(str);
-		if (mongrid_init(mon, plyr.stat_tid, sink_name))
+		char lbuf[128];
+		nstr_t layout = load_layout(nstr_init(lbuf, sizeof(lbuf)));
+		if (mongrid_init(mon, layout, plyr.stat_tid, sink_name))
 			break;
 		player_load_cmds(&plyr, mon);
 		mongrid_run();
@@ -371,5 +453,6 @@ void run_player(bool gui, bool stats, const char *port) {
 	}
 	mongrid_destroy();
 	cxn_destroy(plyr.cxn);
+	mserve_destroy();
 	config_destroy();
 }
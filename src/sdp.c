@@ -38,7 +38,8 @@ static const long HTTP_OK = 200;
 
 static bool sdp_data_check(nstr_t str) {
 	return nstr_starts_with(str, "http://")
-	    && nstr_contains(str, ".sdp");
+	    && nstr_contains(str, ".sdp")
+	    && !nstr_contains(str, " ");
 }
 
 void sdp_data_init(struct sdp_data *sdp, nstr_t loc) {
@@ -52,6 +53,35 @@ void sdp_data_init(struct sdp_data *sdp, nstr_t loc) {
 	sdp->sprops = nstr_init(sdp->sprop_buf, sizeof(sdp->sprop_buf));
 }
 
+/* Get parameter sets from media caps: H264 sprop-parameter-sets, or HEVC
+ * sprop-vps/sps/pps as "vps;sps;pps" */
+static bool sdp_sprops(const GstStructure *gstr, nstr_t *sprops) {
+	const char *sp = gst_structure_get_string(gstr, "sprop-parameter-sets");
+	const char *vps = gst_structure_get_string(gstr, "sprop-vps");
+	const char *sps = gst_structure_get_string(gstr, "sprop-sps");
+	const char *pps = gst_structure_get_string(gstr, "sprop-pps");
+	if (sp) {
+		nstr_cat_z(sprops, sp);
+		return true;
+	}
+	if (vps && sps && pps) {
+		nstr_cat_z(sprops, vps);
+		nstr_cat_z(sprops, ";");
+		nstr_cat_z(sprops, sps);
+		nstr_cat_z(sprops, ";");
+		nstr_cat_z(sprops, pps);
+		return true;
+	}
+	return false;
+}
+
+/* Check if media caps are for an encoding without out-of-band parameter
+ * sets; AV1 carries its sequence header in the stream */
+static bool sdp_inband_params(const GstStructure *gstr) {
+	const char *enc = gst_structure_get_string(gstr, "encoding-name");
+	return enc && strcmp("AV1", enc) == 0;
+}
+
 static bool sdp_data_parse(struct sdp_data *sdp, nstr_t str) {
 	nstr_t udp = nstr_init(sdp->udp_buf, sizeof(sdp->udp_buf));
 	nstr_t sprops = nstr_init(sdp->sprop_buf, sizeof(sdp->sprop_buf));
@@ -74,7 +104,6 @@ static bool sdp_data_parse(struct sdp_data *sdp, nstr_t str) {
 		const GstSDPConnection *conn;
 		const GstCaps *caps;
 		const GstStructure *gstr;
-		const char *sp;
 
 		if (strncmp("video", gst_sdp_media_get_media(media), 5) != 0)
 			continue;
@@ -84,15 +113,12 @@ static bool sdp_data_parse(struct sdp_data *sdp, nstr_t str) {
 			continue;
 		caps = gst_sdp_media_get_caps_from_media(media, (gint) 96);
 		gstr = gst_caps_get_structure(caps, 0);
-		if (!gst_structure_has_field_typed(gstr, "sprop-parameter-sets",
-		                                   G_TYPE_STRING))
+		if (!sdp_sprops(gstr, &sprops) && !sdp_inband_params(gstr))
 			continue;
 
 		snprintf(uri, sizeof(uri), "udp://%s:%d", conn->address,
 			gst_sdp_media_get_port(media));
 		nstr_cat_z(&udp, uri);
-		sp = gst_structure_get_string(gstr, "sprop-parameter-sets");
-		nstr_cat_z(&sprops, sp);
 		goto out;
 	}
 	elog_err("sdp_data_parse failed: no valid media\n");
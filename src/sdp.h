@@ -10,7 +10,7 @@ struct sdp_data {
 	char     fetch_buf[1024];
 	char     loc_buf[128];
 	char     udp_buf[128];
-	char     sprop_buf[64];
+	char     sprop_buf[160];
 	nstr_t   cache;
 	nstr_t   fetch;
 	nstr_t   loc;
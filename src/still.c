@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2026  Minnesota Department of Transportation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <curl/curl.h>
+#include <gst/gst.h>
+#include "elog.h"
+#include "lock.h"
+#include "still.h"
+
+/*
+ * Still images (PNG) are fetched with HTTP and decoded once into a cairo
+ * surface, which the cell draws when exposed.  No pipeline runs, so a static
+ * image costs nothing between fetches.
+ *
+ * When polling is configured, the image is fetched again periodically with a
+ * conditional GET (If-None-Match / If-Modified-Since), so an unchanged image
+ * is neither transferred nor decoded.
+ */
+
+static const int64_t TIMEOUT_SEC = 5L;
+static const long HTTP_OK = 200;
+static const long HTTP_NOT_MODIFIED = 304;
+
+#define MAX_PNG_BYTES	(8 << 20)
+#define RETRY_SEC	(10)
+
+/* Poll interval (seconds; 0 to fetch once) */
+static uint32_t poll_sec = 0;
+
+struct still {
+	struct lock	lock;
+	pthread_cond_t	cond;
+	gint		refs;            /* atomic: caller and thread */
+	bool		stopped;
+	char		uri[128];
+	char		etag[128];       /* last ETag (fetch thread only) */
+	long		modified;        /* last Last-Modified (-1 unknown) */
+	cairo_surface_t	*surface;
+	void		(*ready)(void *data);
+	void		*data;
+};
+
+/* One HTTP fetch */
+struct fetch {
+	GByteArray	*png;
+	char		etag[128];
+};
+
+/** Configure poll interval (seconds).
+ *
+ * @return true if spec is valid. */
+bool still_config_poll(const char *spec) {
+	char *end;
+	long sec = strtol(spec, &end, 10);
+	if (end == spec || *end != '\0' || sec < 0 || sec > 86400)
+		return false;
+	poll_sec = sec;
+	return true;
+}
+
+static void still_unref(struct still *sl) {
+	if (g_atomic_int_dec_and_test(&sl->refs)) {
+		if (sl->surface)
+			cairo_surface_destroy(sl->surface);
+		pthread_cond_destroy(&sl->cond);
+		lock_destroy(&sl->lock);
+		g_free(sl);
+	}
+}
+
+static size_t still_write(void *contents, size_t size, size_t nmemb,
+	void *uptr)
+{
+	struct fetch *f = uptr;
+	size_t sz = size * nmemb;
+	if (f->png->len + sz > MAX_PNG_BYTES)
+		return 0;
+	g_byte_array_append(f->png, contents, sz);
+	return sz;
+}
+
+static size_t still_header(char *buf, size_t size, size_t nitems, void *uptr)
+{
+	struct fetch *f = uptr;
+	size_t sz = size * nitems;
+	if (sz > 5 && g_ascii_strncasecmp(buf, "ETag:", 5) == 0) {
+		const char *v = buf + 5;
+		size_t n = sz - 5;
+		while (n > 0 && (*v == ' ' || *v == '\t')) {
+			v++;
+			n--;
+		}
+		while (n > 0 && (v[n - 1] == '\r' || v[n - 1] == '\n'))
+			n--;
+		if (n < sizeof(f->etag)) {
+			memcpy(f->etag, v, n);
+			f->etag[n] = '\0';
+		}
+	}
+	return sz;
+}
+
+/* PNG read position, for decoding from memory */
+struct png_read {
+	const GByteArray	*png;
+	guint			pos;
+};
+
+static cairo_status_t png_read_cb(void *closure, unsigned char *data,
+	unsigned int len)
+{
+	struct png_read *rd = closure;
+	if (rd->pos + len > rd->png->len)
+		return CAIRO_STATUS_READ_ERROR;
+	memcpy(data, rd->png->data + rd->pos, len);
+	rd->pos += len;
+	return CAIRO_STATUS_SUCCESS;
+}
+
+static cairo_surface_t *still_decode(const GByteArray *png) {
+	struct png_read rd = { png, 0 };
+	cairo_surface_t *surf = cairo_image_surface_create_from_png_stream(
+		png_read_cb, &rd);
+	if (cairo_surface_status(surf) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(surf);
+		return NULL;
+	}
+	return surf;
+}
+
+/* Perform a (conditional) GET, returning the HTTP response code */
+static long still_get(struct still *sl, struct fetch *f) {
+	struct curl_slist *hdrs = NULL;
+	CURLcode rc;
+	long resp = 0;
+
+	CURL *ch = curl_easy_init();
+	curl_easy_setopt(ch, CURLOPT_URL, sl->uri);
+	curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(ch, CURLOPT_CONNECTTIMEOUT, TIMEOUT_SEC);
+	curl_easy_setopt(ch, CURLOPT_TIMEOUT, TIMEOUT_SEC);
+	curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, still_write);
+	curl_easy_setopt(ch, CURLOPT_WRITEDATA, f);
+	curl_easy_setopt(ch, CURLOPT_HEADERFUNCTION, still_header);
+	curl_easy_setopt(ch, CURLOPT_HEADERDATA, f);
+	curl_easy_setopt(ch, CURLOPT_HTTPAUTH, CURLAUTH_BASIC|CURLAUTH_DIGEST);
+	curl_easy_setopt(ch, CURLOPT_FILETIME, 1L);
+	if (sl->surface && sl->etag[0]) {
+		char hdr[160];
+		snprintf(hdr, sizeof(hdr), "If-None-Match: %s", sl->etag);
+		hdrs = curl_slist_append(hdrs, hdr);
+		curl_easy_setopt(ch, CURLOPT_HTTPHEADER, hdrs);
+	} else if (sl->surface && sl->modified >= 0) {
+		curl_easy_setopt(ch, CURLOPT_TIMECONDITION,
+			(long) CURL_TIMECOND_IFMODSINCE);
+		curl_easy_setopt(ch, CURLOPT_TIMEVALUE, sl->modified);
+	}
+	rc = curl_easy_perform(ch);
+	if (rc != CURLE_OK)
+		elog_err("curl error: %s\n", curl_easy_strerror(rc));
+	else {
+		curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &resp);
+		if (HTTP_OK == resp)
+			curl_easy_getinfo(ch, CURLINFO_FILETIME, &sl->modified);
+		else if (HTTP_NOT_MODIFIED != resp)
+			elog_err("HTTP error %ld from %s\n", resp, sl->uri);
+	}
+	curl_slist_free_all(hdrs);
+	curl_easy_cleanup(ch);
+	return resp;
+}
+
+/* Fetch and decode image.  The surface is only replaced when changed. */
+static bool still_fetch(struct still *sl) {
+	struct fetch f;
+	f.png = g_byte_array_new();
+	f.etag[0] = '\0';
+	long resp = still_get(sl, &f);
+	cairo_surface_t *surf = (HTTP_OK == resp) ? still_decode(f.png) : NULL;
+	g_byte_array_unref(f.png);
+	if (HTTP_OK == resp && !surf)
+		elog_err("Invalid PNG: %s\n", sl->uri);
+	if (surf) {
+		memcpy(sl->etag, f.etag, sizeof(sl->etag));
+		lock_acquire(&sl->lock, __func__);
+		cairo_surface_t *old = sl->surface;
+		sl->surface = surf;
+		if (!sl->stopped)
+			sl->ready(sl->data);
+		lock_release(&sl->lock, __func__);
+		if (old)
+			cairo_surface_destroy(old);
+	}
+	return surf || HTTP_NOT_MODIFIED == resp;
+}
+
+/* Wait for a number of seconds, or until stopped.  Lock must be held. */
+static void still_wait(struct still *sl, uint32_t sec) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += sec;
+	while (!sl->stopped) {
+		int rc = pthread_cond_timedwait(&sl->cond, &sl->lock.mutex,
+			&ts);
+		if (rc == ETIMEDOUT)
+			break;
+		if (rc) {
+			elog_err("pthread_cond_timedwait: %s\n", strerror(rc));
+			break;
+		}
+	}
+}
+
+static void *still_thread(void *arg) {
+	struct still *sl = arg;
+	lock_acquire(&sl->lock, __func__);
+	while (!sl->stopped) {
+		lock_release(&sl->lock, __func__);
+		bool ok = still_fetch(sl);
+		lock_acquire(&sl->lock, __func__);
+		/* Retry until the first image is shown */
+		uint32_t sec = (ok || sl->surface) ? poll_sec : RETRY_SEC;
+		if (0 == sec)
+			break;
+		still_wait(sl, sec);
+	}
+	lock_release(&sl->lock, __func__);
+	still_unref(sl);
+	return NULL;
+}
+
+/** Start fetching a still image.
+ *
+ * @param ready Called (from the fetch thread) when a new image is ready.
+ * @return Still, or NULL on error. */
+struct still *still_start(const char *uri, void (*ready)(void *data),
+	void *data)
+{
+	pthread_t tid;
+	struct still *sl = g_malloc0(sizeof(struct still));
+	lock_init(&sl->lock);
+	pthread_cond_init(&sl->cond, NULL);
+	sl->refs = 2;
+	snprintf(sl->uri, sizeof(sl->uri), "%s", uri);
+	sl->modified = -1;
+	sl->ready = ready;
+	sl->data = data;
+	int rc = pthread_create(&tid, NULL, still_thread, sl);
+	if (rc) {
+		elog_err("pthread_create: %s\n", strerror(rc));
+		sl->refs = 1;
+		still_unref(sl);
+		return NULL;
+	}
+	pthread_detach(tid);
+	return sl;
+}
+
+/** Stop a still image.  A fetch in progress finishes in the background. */
+void still_stop(struct still *sl) {
+	lock_acquire(&sl->lock, __func__);
+	sl->stopped = true;
+	pthread_cond_signal(&sl->cond);
+	lock_release(&sl->lock, __func__);
+	still_unref(sl);
+}
+
+/** Get a reference to the current image surface (or NULL) */
+cairo_surface_t *still_surface(struct still *sl) {
+	cairo_surface_t *surf = NULL;
+	lock_acquire(&sl->lock, __func__);
+	if (sl->surface)
+		surf = cairo_surface_reference(sl->surface);
+	lock_release(&sl->lock, __func__);
+	return surf;
+}
@@ -0,0 +1,15 @@
+#ifndef STILL_H
+#define STILL_H
+
+#include <stdbool.h>
+#include <cairo.h>
+
+struct still;
+
+bool still_config_poll(const char *spec);
+struct still *still_start(const char *uri, void (*ready)(void *data),
+	void *data);
+void still_stop(struct still *sl);
+cairo_surface_t *still_surface(struct still *sl);
+
+#endif
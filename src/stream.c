@@ -12,12 +12,19 @@
  * GNU General Public License for more details.
  */
 
+#define _GNU_SOURCE	/* for sched_setaffinity */
 #include <assert.h>
+#include <errno.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <gst/video/video.h>
 #include <gst/video/videooverlay.h>
 #include "elog.h"
+#include "idrcache.h"
+#include "metrics.h"
 #include "nstr.h"
+#include "overlay.h"
 #include "config.h"
 #include "stream.h"
 
@@ -29,6 +36,41 @@
 
 static const uint32_t DEFAULT_LATENCY = 50;
 
+/* Low-latency profile: jitterbuffer latency (ms) and queue size (ns) */
+static const uint32_t LOW_LATENCY = 10;
+#define LOW_QUEUE_NS	(100000000)
+
+/* Decoder thread counts by resolution class (0 for decoder default) */
+enum res_class { RES_SD, RES_HD, RES_FHD, RES_CLASSES };
+static uint32_t decode_threads[RES_CLASSES];
+
+/* Video areas at most this tall are decoded at reduced quality.  Half size
+ * decoding of a 720p stream still covers the area. */
+#define REDUCED_HEIGHT	(360)
+
+/* Frame interval of sinks when frame rate is capped by governor */
+#define DEGRADE_THROTTLE_NS	(200000000)
+
+/* Sink checks without frames before a keyframe-only stream is stuck */
+#define KEY_ONLY_STALL_CHECKS	(5)
+
+/* CPU sets for pinning streaming threads, assigned to cells in turn */
+#define MAX_CPU_SETS	(16)
+static uint64_t cpu_sets[MAX_CPU_SETS];
+static uint32_t n_cpu_sets;
+
+/* Probe mode: headless streams are only depayloaded and parsed */
+static bool probe_only;
+
+/* Raw formats accepted by each sink type, queried once.  Only accessed
+ * while building pipelines, with the grid lock held. */
+#define MAX_SINK_TYPES	(4)
+struct sink_formats {
+	char		factory[32];
+	GstCaps		*caps;           /* NULL if sink accepts anything */
+};
+static struct sink_formats sink_formats[MAX_SINK_TYPES];
+
 static GstElement *make_element(const char *factory_name, const char *name) {
 	GstElementFactory *factory = gst_element_factory_find(factory_name);
 	if (!factory) {
@@ -91,17 +133,39 @@ static bool stream_is_vaapi(const struct stream *st) {
 	return strcmp("VAAPI", st->sink_name) == 0;
 }
 
+/* Count frames on sink pad; read without locking by stream_check_sink */
+static GstPadProbeReturn sink_probe_cb(GstPad *pad, GstPadProbeInfo *info,
+	gpointer user_data)
+{
+	struct stream *st = user_data;
+	GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+	__atomic_store_n(&st->sink_pts, GST_BUFFER_PTS(buf), __ATOMIC_RELAXED);
+	g_atomic_int_inc(&st->frames);
+	return GST_PAD_PROBE_OK;
+}
+
+static void stream_probe_sink(struct stream *st, GstElement *sink) {
+	GstPad *pad = gst_element_get_static_pad(sink, "sink");
+	if (pad) {
+		gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, sink_probe_cb,
+			st, NULL);
+		gst_object_unref(pad);
+	}
+}
+
 static GstElement *stream_create_real_sink(struct stream *st) {
 	GstElement *sink = stream_is_vaapi(st)
 	      ? make_element("glimagesink", NULL)
 	      : make_element("xvimagesink", NULL);
 	if (sink != NULL) {
 		// Playback sometimes stutters without "sync" enabled
-		g_object_set(G_OBJECT(sink), "sync", TRUE, NULL);
+		// (low-latency shows frames as soon as they are decoded)
+		g_object_set(G_OBJECT(sink), "sync", !st->low_latency, NULL);
 		g_object_set(G_OBJECT(sink), "force-aspect-ratio", st->aspect,
 			NULL);
 		GstVideoOverlay *overlay = GST_VIDEO_OVERLAY(sink);
 		gst_video_overlay_set_window_handle(overlay, st->handle);
+		stream_probe_sink(st, sink);
 		st->sink = sink;
 	} else {
 		elog_err("Sink element not created!\n");
@@ -109,39 +173,108 @@ static GstElement *stream_create_real_sink(struct stream *st) {
 	return sink;
 }
 
+static GstElement *stream_create_inter_sink(struct stream *st) {
+	GstElement *sink = make_element("intervideosink", NULL);
+	if (sink != NULL) {
+		g_object_set(G_OBJECT(sink), "sync", !st->low_latency, NULL);
+		g_object_set(G_OBJECT(sink), "channel", st->channel, NULL);
+		stream_probe_sink(st, sink);
+		st->sink = sink;
+	}
+	return sink;
+}
+
+/* Create sink for probe mode, counting frames like a real sink */
+static GstElement *stream_create_probe_sink(struct stream *st) {
+	GstElement *sink = make_element("fakesink", NULL);
+	if (sink != NULL) {
+		stream_probe_sink(st, sink);
+		st->sink = sink;
+	}
+	return sink;
+}
+
+static bool stream_has_output(const struct stream *st) {
+	return st->handle || st->channel[0];
+}
+
+static GstElement *stream_create_sink(struct stream *st) {
+	if (st->handle)
+		return stream_create_real_sink(st);
+	else if (st->channel[0])
+		return stream_create_inter_sink(st);
+	else
+		return make_element("fakesink", NULL);
+}
+
 static void stream_add_sink(struct stream *st) {
-	GstElement *sink = (st->handle)
-	      ? stream_create_real_sink(st)
-	      : make_element("fakesink", NULL);
-	stream_add(st, sink);
+	stream_add(st, stream_create_sink(st));
+}
+
+static void stream_config_text(struct stream *st) {
+	if (st->ovl) {
+		overlay_set_text(st->ovl, st->description, st->font_sz,
+			st->height);
+	}
+}
+
+/* Create a pass-through element carrying the description overlay */
+static GstElement *stream_create_text(struct stream *st) {
+	GstElement *idn = make_element("identity", NULL);
+	if (idn) {
+		st->ovl = overlay_add(idn);
+		stream_config_text(st);
+	}
+	return idn;
 }
 
 static void stream_add_text(struct stream *st) {
-	char font[32];
-	snprintf(font, sizeof(font), "Overpass, Bold %d", st->font_sz);
-	GstElement *txt = make_element("textoverlay", NULL);
-	g_object_set(G_OBJECT(txt), "text", st->description, NULL);
-	g_object_set(G_OBJECT(txt), "font-desc", font, NULL);
-	g_object_set(G_OBJECT(txt), "shaded-background", FALSE, NULL);
-	g_object_set(G_OBJECT(txt), "color", 0xFFFFFFE0, NULL);
-	g_object_set(G_OBJECT(txt), "halignment", 2, NULL); // right
-	g_object_set(G_OBJECT(txt), "valignment", 2, NULL); // top
-	g_object_set(G_OBJECT(txt), "wrap-mode", -1, NULL); // no wrapping
-	g_object_set(G_OBJECT(txt), "xpad", 48, NULL);
-	g_object_set(G_OBJECT(txt), "ypad", 36, NULL);
-	g_object_set(G_OBJECT(txt), "scale-mode", 2, NULL); // display
-	stream_add(st, txt);
+	stream_add(st, stream_create_text(st));
 }
 
+/* Tee after the decoder allows other streams to share it.  It is only added
+ * when another cell plays the same source, since it costs a pad hop per
+ * buffer. */
+static void stream_add_tee(struct stream *st) {
+	GstElement *tee = make_element("tee", NULL);
+	stream_add(st, tee);
+	st->tee = tee;
+}
+
+/* Queue before depayloading; never leaky, since dropping RTP packets here
+ * would corrupt frames.  Stale frames are dropped before the sink. */
 static void stream_add_queue(struct stream *st) {
 	GstElement *que = make_element("queue", NULL);
-	g_object_set(G_OBJECT(que), "max-size-time", 650000000, NULL);
+	if (st->low_latency) {
+		g_object_set(G_OBJECT(que), "max-size-time", LOW_QUEUE_NS,
+			NULL);
+	} else
+		g_object_set(G_OBJECT(que), "max-size-time", 650000000, NULL);
+	stream_add(st, que);
+}
+
+/* Leaky queue before sink drops stale frames if the sink falls behind */
+static void stream_add_leaky_queue(struct stream *st) {
+	GstElement *que = make_element("queue", NULL);
+	g_object_set(G_OBJECT(que), "max-size-buffers", 1, NULL);
+	g_object_set(G_OBJECT(que), "max-size-bytes", 0, NULL);
+	g_object_set(G_OBJECT(que), "max-size-time", 0, NULL);
+	g_object_set(G_OBJECT(que), "leaky", 2, NULL); // downstream
 	stream_add(st, que);
 }
 
+/* Get jitterbuffer latency (ms) */
+static uint32_t stream_jitter_latency(const struct stream *st) {
+	return (st->low_latency)
+	      ? MIN(st->latency, LOW_LATENCY)
+	      : __atomic_load_n(&st->adapt.latency, __ATOMIC_RELAXED);
+}
+
 static void stream_add_jitter(struct stream *st) {
 	GstElement *jtr = make_element("rtpjitterbuffer", NULL);
-	g_object_set(G_OBJECT(jtr), "latency", st->latency, NULL);
+	g_object_set(G_OBJECT(jtr), "latency", stream_jitter_latency(st), NULL);
+	if (st->low_latency)
+		g_object_set(G_OBJECT(jtr), "drop-on-latency", TRUE, NULL);
 	g_object_set(G_OBJECT(jtr), "max-dropout-time", 1500, NULL);
 	stream_add(st, jtr);
 	st->jitter = jtr;
@@ -161,10 +294,30 @@ static GstCaps *create_caps_generic(const struct stream *st) {
 	                NULL);
 }
 
+/* HEVC parameter sets are "vps;sps;pps", as parsed from SDP */
+static GstCaps *create_caps_h265(const struct stream *st) {
+	GstCaps *caps = gst_caps_new_simple("application/x-rtp",
+	                "clock-rate", G_TYPE_INT, 90000,
+	                NULL);
+	gchar **ps = g_strsplit(st->sprops, ";", 3);
+	if (g_strv_length(ps) == 3) {
+		gst_caps_set_simple(caps,
+		                "sprop-vps", G_TYPE_STRING, ps[0],
+		                "sprop-sps", G_TYPE_STRING, ps[1],
+		                "sprop-pps", G_TYPE_STRING, ps[2],
+		                NULL);
+	}
+	g_strfreev(ps);
+	return caps;
+}
+
 static GstCaps *stream_create_caps(const struct stream *st) {
-	return (strcmp("MPEG2", st->encoding) == 0)
-	      ?	create_caps_mpeg2()
-	      : create_caps_generic(st);
+	if (strcmp("MPEG2", st->encoding) == 0)
+		return create_caps_mpeg2();
+	else if (strcmp("HEVC", st->encoding) == 0)
+		return create_caps_h265(st);
+	else
+		return create_caps_generic(st);
 }
 
 static void stream_add_filter(struct stream *st) {
@@ -173,6 +326,7 @@ static void stream_add_filter(struct stream *st) {
 	g_object_set(G_OBJECT(fltr), "caps", caps, NULL);
 	gst_caps_unref(caps);
 	stream_add(st, fltr);
+	st->fltr = fltr;
 }
 
 static void stream_add_src_udp(struct stream *st) {
@@ -181,6 +335,7 @@ static void stream_add_src_udp(struct stream *st) {
 	// Post GstUDPSrcTimeout messages after 2 seconds (ns)
 	g_object_set(G_OBJECT(src), "timeout", 2 * ONE_SEC_NS, NULL);
 	stream_add(st, src);
+	st->src = src;
 }
 
 static const char *stream_location_http(const struct stream *st) {
@@ -202,6 +357,7 @@ static void stream_add_src_http(struct stream *st) {
 	g_object_set(G_OBJECT(src), "timeout", 2, NULL);
 	g_object_set(G_OBJECT(src), "retries", 0, NULL);
 	stream_add(st, src);
+	st->src = src;
 }
 
 static gboolean select_stream_cb(GstElement *src, guint num, GstCaps *caps,
@@ -218,12 +374,13 @@ static gboolean select_stream_cb(GstElement *src, guint num, GstCaps *caps,
 static void stream_add_src_rtsp(struct stream *st) {
 	GstElement *src = make_element("rtspsrc", NULL);
 	g_object_set(G_OBJECT(src), "location", st->location, NULL);
-	g_object_set(G_OBJECT(src), "latency", st->latency, NULL);
+	g_object_set(G_OBJECT(src), "latency", stream_jitter_latency(st), NULL);
 	g_object_set(G_OBJECT(src), "timeout", ONE_SEC_US, NULL);
 	g_object_set(G_OBJECT(src), "tcp-timeout", TEN_SEC_US, NULL);
 	g_object_set(G_OBJECT(src), "do-retransmission", FALSE, NULL);
 	g_signal_connect(src, "select-stream", G_CALLBACK(select_stream_cb),st);
 	stream_add(st, src);
+	st->src = src;
 }
 
 /** Set crop parameters */
@@ -296,6 +453,58 @@ static gint stream_crop_right(const struct stream *st, gint width) {
 	return crop_pix(width, num, den, st->hgap);
 }
 
+static void stream_config_crop(const struct stream *st, GstElement *crop,
+	gint width, gint height)
+{
+	gpointer gobj = G_OBJECT(crop);
+	g_object_set(gobj, "top", stream_crop_top(st, height), NULL);
+	g_object_set(gobj, "bottom", stream_crop_bottom(st, height), NULL);
+	g_object_set(gobj, "left", stream_crop_left(st, width), NULL);
+	g_object_set(gobj, "right", stream_crop_right(st, width), NULL);
+}
+
+static GstPadProbeReturn crop_caps_cb(GstPad *pad, GstPadProbeInfo *info,
+	gpointer data)
+{
+	const struct stream *st = data;
+	GstEvent *ev = GST_PAD_PROBE_INFO_EVENT(info);
+	if (GST_EVENT_TYPE(ev) == GST_EVENT_CAPS) {
+		GstElement *crop = gst_pad_get_parent_element(pad);
+		GstCaps *caps;
+		gst_event_parse_caps(ev, &caps);
+		GstStructure *s = gst_caps_get_structure(caps, 0);
+		gint height = 0;
+		gint width = 0;
+		gst_structure_get_int(s, "width", &width);
+		gst_structure_get_int(s, "height", &height);
+		if (crop && width > 0 && height > 0)
+			stream_config_crop(st, crop, width, height);
+		if (crop)
+			gst_object_unref(crop);
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+/** Create a crop element.
+ *
+ * videocrop only attaches a crop meta to each buffer when downstream (the
+ * sink) supports it, so no pixels are copied.  Otherwise, it copies the
+ * cropped region.  Crop must be configured from the input caps, before they
+ * reach the element. */
+static GstElement *stream_create_crop(const struct stream *st) {
+	GstElement *crop = make_element("videocrop", NULL);
+	if (crop) {
+		GstPad *pad = gst_element_get_static_pad(crop, "sink");
+		if (pad) {
+			gst_pad_add_probe(pad,
+				GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+				crop_caps_cb, (gpointer) st, NULL);
+			gst_object_unref(pad);
+		}
+	}
+	return crop;
+}
+
 static bool stream_has_description(const struct stream *st) {
 	return st->description[0] != '\0';
 }
@@ -316,10 +525,371 @@ static bool stream_is_location_ok(const struct stream *st) {
 	return stream_is_udp(st) || stream_is_http(st) || stream_is_rtsp(st);
 }
 
+static GstPadProbeReturn decode_in_cb(GstPad *pad, GstPadProbeInfo *info,
+	gpointer user_data)
+{
+	metrics_decode_in(user_data, GST_PAD_PROBE_INFO_BUFFER(info));
+	return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn decode_out_cb(GstPad *pad, GstPadProbeInfo *info,
+	gpointer user_data)
+{
+	metrics_decode_out(user_data, GST_PAD_PROBE_INFO_BUFFER(info));
+	return GST_PAD_PROBE_OK;
+}
+
+static void stream_probe_pad(struct stream *st, GstElement *elem,
+	const char *name, GstPadProbeCallback cb)
+{
+	GstPad *pad = gst_element_get_static_pad(elem, name);
+	if (pad) {
+		gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, cb,
+			st->metrics, NULL);
+		gst_object_unref(pad);
+	}
+}
+
+static bool has_property(GstElement *elem, const char *name) {
+	return g_object_class_find_property(G_OBJECT_GET_CLASS(elem), name)
+	       != NULL;
+}
+
+/* Configure decoder to output frames without delay */
+static void stream_config_low_delay(GstElement *dec) {
+	if (has_property(dec, "low-latency"))		// vaapi
+		g_object_set(G_OBJECT(dec), "low-latency", TRUE, NULL);
+	if (has_property(dec, "thread-type"))		// libav
+		g_object_set(G_OBJECT(dec), "thread-type", 2, NULL); // slice
+	if (has_property(dec, "max-frame-delay"))	// dav1d
+		g_object_set(G_OBJECT(dec), "max-frame-delay", (gint64) 1, NULL);
+}
+
+/** Configure decoder thread counts, as "sd,hd,fhd".
+ *
+ * Missing counts repeat the previous one.
+ * @return true if spec is valid. */
+bool stream_config_threads(const char *spec) {
+	const char *p = spec;
+	uint32_t n = 0;
+	for (;;) {
+		char *end;
+		long t = strtol(p, &end, 10);
+		if (end == p || t < 0 || t > 64 || n >= RES_CLASSES)
+			return false;
+		decode_threads[n++] = t;
+		if (*end == '\0')
+			break;
+		if (*end != ',')
+			return false;
+		p = end + 1;
+	}
+	for (; n < RES_CLASSES; n++)
+		decode_threads[n] = decode_threads[n - 1];
+	return true;
+}
+
+static bool decode_threads_configured(void) {
+	for (int i = 0; i < RES_CLASSES; i++) {
+		if (decode_threads[i])
+			return true;
+	}
+	return false;
+}
+
+/* Get resolution class of a frame height (unknown is largest class) */
+static enum res_class res_class(gint height) {
+	if (height <= 0)
+		return RES_FHD;
+	else if (height < 720)
+		return RES_SD;
+	else if (height < 1080)
+		return RES_HD;
+	else
+		return RES_FHD;
+}
+
+/* Get thread count property of a decoder, if it has one */
+static const char *dec_threads_prop(GstElement *dec) {
+	if (has_property(dec, "max-threads"))		// libav
+		return "max-threads";
+	else if (has_property(dec, "n-threads"))	// dav1d
+		return "n-threads";
+	else
+		return NULL;	// openh264dec has no thread control
+}
+
+/* Set decoder threads from caps, before the decoder opens its codec */
+static GstPadProbeReturn threads_cb(GstPad *pad, GstPadProbeInfo *info,
+	gpointer user_data)
+{
+	GstEvent *ev = GST_PAD_PROBE_INFO_EVENT(info);
+	if (GST_EVENT_TYPE(ev) == GST_EVENT_CAPS) {
+		GstCaps *caps;
+		gint height = 0;
+		gst_event_parse_caps(ev, &caps);
+		GstStructure *s = gst_caps_get_structure(caps, 0);
+		gst_structure_get_int(s, "height", &height);
+		GstElement *dec = gst_pad_get_parent_element(pad);
+		if (dec) {
+			g_object_set(G_OBJECT(dec), dec_threads_prop(dec),
+				decode_threads[res_class(height)], NULL);
+			gst_object_unref(dec);
+		}
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+/* Configure decoder thread count, if it has one */
+static void stream_config_threads_dec(GstElement *dec) {
+	if (decode_threads_configured() && dec_threads_prop(dec)) {
+		GstPad *pad = gst_element_get_static_pad(dec, "sink");
+		if (pad) {
+			gst_pad_add_probe(pad,
+				GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+				threads_cb, NULL, NULL);
+			gst_object_unref(pad);
+		}
+	}
+}
+
+/* Check if video area is small enough for reduced quality decoding */
+static bool stream_is_reduced(const struct stream *st) {
+	return st->height > 0 && st->height <= REDUCED_HEIGHT;
+}
+
+/* Configure decoder quality for size of video area.  Codecs read these when
+ * opened, so a change applies on the next start. */
+static void stream_config_quality(const struct stream *st, GstElement *dec) {
+	bool reduced = stream_is_reduced(st);
+	if (has_property(dec, "lowres"))		// libav: half size
+		g_object_set(G_OBJECT(dec), "lowres", reduced ? 1 : 0, NULL);
+	if (has_property(dec, "idct-method")) {		// jpegdec
+		g_object_set(G_OBJECT(dec), "idct-method",
+			reduced ? 1 : 0, NULL);		// ifast : islow
+	}
+}
+
+/* Skip levels of the probe before the decoder */
+enum skip {
+	SKIP_NONE,      /* decode everything */
+	SKIP_DELTA,     /* decode keyframes only */
+	SKIP_RESUME,    /* skip delta units until the next keyframe */
+	SKIP_ALL,       /* decode nothing (hidden) */
+};
+
+/* Drop buffers before the decoder while skipping */
+static GstPadProbeReturn skip_cb(GstPad *pad, GstPadProbeInfo *info,
+	gpointer user_data)
+{
+	gint *skip = user_data;
+	GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+	bool delta = GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT);
+	switch (g_atomic_int_get(skip)) {
+	case SKIP_ALL:
+		return GST_PAD_PROBE_DROP;
+	case SKIP_DELTA:
+		return delta ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+	case SKIP_RESUME:
+		if (delta)
+			return GST_PAD_PROBE_DROP;
+		g_atomic_int_compare_and_exchange(skip, SKIP_RESUME,
+			SKIP_NONE);
+		return GST_PAD_PROBE_OK;
+	default:
+		return GST_PAD_PROBE_OK;
+	}
+}
+
+/* Check if delta units should be skipped */
+static bool stream_is_skipping(const struct stream *st) {
+	return st->key_only || st->degrade >= DEGRADE_KEY_ONLY;
+}
+
+static void stream_update_skip(struct stream *st) {
+	if (st->skip) {
+		enum skip prev = g_atomic_int_get(st->skip);
+		enum skip skip = SKIP_NONE;
+		if (st->hidden || st->degrade >= DEGRADE_PAUSE)
+			skip = SKIP_ALL;
+		else if (stream_is_skipping(st))
+			skip = SKIP_DELTA;
+		else if (prev == SKIP_ALL || prev == SKIP_RESUME)
+			skip = SKIP_RESUME;
+		g_atomic_int_set(st->skip, skip);
+	}
+}
+
+static void stream_add_skip_probe(struct stream *st, GstElement *dec) {
+	GstPad *pad = gst_element_get_static_pad(dec, "sink");
+	if (pad) {
+		gint *skip = g_malloc0(sizeof(gint));
+		gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, skip_cb,
+			skip, g_free);
+		gst_object_unref(pad);
+		st->skip = skip;
+		stream_update_skip(st);
+	}
+}
+
+static const char *element_factory_name(GstElement *elem) {
+	GstElementFactory *factory = gst_element_get_factory(elem);
+	return (factory)
+	      ? gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory))
+	      : "unknown";
+}
+
+/* Check if all structures of caps are in system memory */
+static bool caps_is_system_memory(const GstCaps *caps) {
+	for (guint i = 0; i < gst_caps_get_size(caps); i++) {
+		GstCapsFeatures *f = gst_caps_get_features(caps, i);
+		if (f && !gst_caps_features_contains(f,
+		    GST_CAPS_FEATURE_MEMORY_SYSTEM_MEMORY))
+			return false;
+	}
+	return true;
+}
+
+/* Get raw system memory formats from caps (without size, rate, etc.) */
+static GstCaps *caps_raw_formats(const GstCaps *caps) {
+	GstCaps *raw = gst_caps_new_empty();
+	for (guint i = 0; i < gst_caps_get_size(caps); i++) {
+		GstStructure *s = gst_caps_get_structure(caps, i);
+		GstCapsFeatures *f = gst_caps_get_features(caps, i);
+		const GValue *fmt = gst_structure_get_value(s, "format");
+		if (gst_structure_has_name(s, "video/x-raw") && fmt &&
+		    (!f || gst_caps_features_contains(f,
+		     GST_CAPS_FEATURE_MEMORY_SYSTEM_MEMORY)))
+		{
+			GstStructure *rs = gst_structure_new_empty(
+				"video/x-raw");
+			gst_structure_set_value(rs, "format", fmt);
+			gst_caps_append_structure(raw, rs);
+		}
+	}
+	if (gst_caps_is_empty(raw)) {
+		gst_caps_unref(raw);
+		return NULL;
+	}
+	return raw;
+}
+
+/* Query raw formats of a sink type.  Display sinks only report what the
+ * display supports after opening it (READY state). */
+static GstCaps *sink_query_formats(const char *factory) {
+	GstCaps *caps = NULL;
+	GstElement *sink = make_element(factory, NULL);
+	if (sink) {
+		gst_element_set_state(sink, GST_STATE_READY);
+		GstPad *pad = gst_element_get_static_pad(sink, "sink");
+		if (pad) {
+			GstCaps *all = gst_pad_query_caps(pad, NULL);
+			if (!gst_caps_is_any(all))
+				caps = caps_raw_formats(all);
+			gst_caps_unref(all);
+			gst_object_unref(pad);
+		}
+		gst_element_set_state(sink, GST_STATE_NULL);
+		gst_object_unref(sink);
+	}
+	return caps;
+}
+
+/* Get raw formats of a sink, querying once per sink type */
+static const GstCaps *sink_get_formats(GstElement *sink) {
+	const char *factory = element_factory_name(sink);
+	for (int i = 0; i < MAX_SINK_TYPES; i++) {
+		struct sink_formats *sf = sink_formats + i;
+		if (strcmp(sf->factory, factory) == 0)
+			return sf->caps;
+		if (!sf->factory[0]) {
+			snprintf(sf->factory, sizeof(sf->factory), "%s",
+				factory);
+			sf->caps = sink_query_formats(factory);
+			return sf->caps;
+		}
+	}
+	return NULL;
+}
+
+/* Add element between decoder and sink: a capsfilter so the decoder
+ * outputs a sink-native format, or a converter when it cannot */
+static void stream_add_native(struct stream *st, GstElement *dec) {
+	const GstCaps *formats = sink_get_formats(st->sink);
+	GstPad *pad = gst_element_get_static_pad(dec, "src");
+	if (!formats || !pad) {
+		if (pad)
+			gst_object_unref(pad);
+		return;
+	}
+	GstCaps *caps = gst_pad_query_caps(pad, NULL);
+	gst_object_unref(pad);
+	/* Hardware decoders negotiate their own memory with the sink */
+	if (caps_is_system_memory(caps)) {
+		if (gst_caps_can_intersect(caps, formats)) {
+			GstElement *fltr = make_element("capsfilter", NULL);
+			g_object_set(G_OBJECT(fltr), "caps", formats, NULL);
+			stream_add(st, fltr);
+		} else {
+			elog_err("Converter added: %s -> %s\n",
+				element_factory_name(dec),
+				element_factory_name(st->sink));
+			stream_add(st, make_element("videoconvert", NULL));
+			st->converters++;
+		}
+	}
+	gst_caps_unref(caps);
+}
+
+/* Check if a decoder needs a scaler for reduced quality.  openh264dec and
+ * mpeg2dec have no quality controls, so their output is scaled down instead,
+ * which keeps the overlay, crop and sink working on small frames. */
+static bool stream_wants_scale(const struct stream *st, GstElement *dec) {
+	const char *factory = element_factory_name(dec);
+	return stream_is_reduced(st) &&
+	      ((strcmp("openh264dec", factory) == 0) ||
+	       (strcmp("mpeg2dec", factory) == 0));
+}
+
+/* Add scaler to fit video area height, without scaling up */
+static void stream_add_scale(struct stream *st) {
+	GstElement *fltr = make_element("capsfilter", NULL);
+	if (fltr) {
+		GstCaps *caps = gst_caps_new_simple("video/x-raw", "height",
+			GST_TYPE_INT_RANGE, 1, st->height, NULL);
+		g_object_set(G_OBJECT(fltr), "caps", caps, NULL);
+		gst_caps_unref(caps);
+	}
+	stream_add(st, fltr);
+	stream_add(st, make_element("videoscale", NULL));
+}
+
+/* Add decoder, with probes for decode latency and arrival jitter */
+static void stream_add_decoder(struct stream *st, GstElement *dec) {
+	if (dec && st->low_latency)
+		stream_config_low_delay(dec);
+	if (dec)
+		stream_add_skip_probe(st, dec);
+	if (dec) {
+		stream_config_threads_dec(dec);
+		stream_config_quality(st, dec);
+		stream_probe_pad(st, dec, "sink", decode_in_cb);
+		stream_probe_pad(st, dec, "src", decode_out_cb);
+		if (st->sink)
+			stream_add_native(st, dec);
+		if (stream_wants_scale(st, dec))
+			stream_add_scale(st);
+	}
+	stream_add(st, dec);
+}
+
 static void stream_add_mpeg4(struct stream *st) {
 	GstElement *dec = make_element("avdec_mpeg4", NULL);
 	g_object_set(G_OBJECT(dec), "output-corrupt", FALSE, NULL);
-	stream_add(st, dec);
+	stream_add_decoder(st, dec);
+	// Parser flags delta units, for keyframe-only mode
+	if (st->key_only)
+		stream_add(st, make_element("mpeg4videoparse", NULL));
 	stream_add(st, make_element("rtpmp4vdepay", NULL));
 }
 
@@ -329,45 +899,230 @@ static GstElement *stream_create_h264dec(const struct stream *st) {
 	      : make_element("openh264dec", NULL);
 }
 
+static GstElement *stream_create_h265dec(const struct stream *st) {
+	return stream_is_vaapi(st)
+	      ? make_element("vaapih265dec", NULL)
+	      : make_element("avdec_h265", NULL);
+}
+
+static GstElement *stream_create_av1dec(const struct stream *st) {
+	return stream_is_vaapi(st)
+	      ? make_element("vaapiav1dec", NULL)
+	      : make_element("dav1ddec", NULL);
+}
+
 static bool stream_is_encoding_ok(const struct stream *st) {
 	return (strcmp("H264", st->encoding) == 0) ||
+	       (strcmp("HEVC", st->encoding) == 0) ||
+	       (strcmp("AV1", st->encoding) == 0) ||
 	       (strcmp("MPEG4", st->encoding) == 0) ||
 	       (strcmp("PNG", st->encoding) == 0) ||
 	       (strcmp("MJPEG", st->encoding) == 0) ||
 	       (strcmp("MPEG2", st->encoding) == 0);
 }
 
+/* Keyframe cache probe state, owned by the probe */
+struct idr_probe {
+	char		key[160];  /* camera ID and location */
+	gboolean	disabled;  /* caps not aligned by access unit */
+	gboolean	started;   /* first buffer seen */
+	gint		holding;   /* holding cached IDR (atomic) */
+};
+
+/* Reset probe for a new location, and load its cached IDR from disk */
+static void idr_probe_reset(struct idr_probe *ip, const struct stream *st) {
+	snprintf(ip->key, sizeof(ip->key), "%s %s", st->cam_id, st->location);
+	ip->disabled = FALSE;
+	ip->started = FALSE;
+	g_atomic_int_set(&ip->holding, 0);
+	idrcache_prefetch(ip->key);
+}
+
+static bool caps_is_au(GstCaps *caps) {
+	GstStructure *s = gst_caps_get_structure(caps, 0);
+	const gchar *align = gst_structure_get_string(s, "alignment");
+	return align && strcmp(align, "au") == 0;
+}
+
+/* Inject cached IDR ahead of the first live access unit */
+static bool idr_probe_inject(struct idr_probe *ip, GstPad *pad, GstCaps *caps,
+	GstBuffer *live)
+{
+	GstBuffer *idr = idrcache_get(ip->key, caps);
+	if (idr) {
+		GstPad *peer = gst_pad_get_peer(pad);
+		idr = gst_buffer_make_writable(idr);
+		GST_BUFFER_PTS(idr) = GST_BUFFER_PTS(live);
+		GST_BUFFER_DTS(idr) = GST_BUFFER_DTS(live);
+		GST_BUFFER_DURATION(idr) = GST_BUFFER_DURATION(live);
+		if (peer) {
+			gst_pad_chain(peer, idr);
+			gst_object_unref(peer);
+			return true;
+		}
+		gst_buffer_unref(idr);
+	}
+	return false;
+}
+
+/* Probe on parser src pad: cache each IDR, and on start inject the cached one.
+ * Live delta units are then dropped until the next live IDR, since they do
+ * not refer to the injected frame. */
+static GstPadProbeReturn idr_probe_cb(GstPad *pad, GstPadProbeInfo *info,
+	gpointer user_data)
+{
+	struct idr_probe *ip = user_data;
+	GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+	if (ip->disabled)
+		return GST_PAD_PROBE_OK;
+	GstCaps *caps = gst_pad_get_current_caps(pad);
+	if (!caps)
+		return GST_PAD_PROBE_OK;
+	if (!caps_is_au(caps)) {
+		ip->disabled = TRUE;
+	} else if (!GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT)) {
+		idrcache_put(ip->key, caps, buf);
+		g_atomic_int_set(&ip->holding, 0);
+	} else if (!ip->started) {
+		if (idr_probe_inject(ip, pad, caps, buf))
+			g_atomic_int_set(&ip->holding, 1);
+	}
+	ip->started = TRUE;
+	gst_caps_unref(caps);
+	return g_atomic_int_get(&ip->holding)
+	      ? GST_PAD_PROBE_DROP
+	      : GST_PAD_PROBE_OK;
+}
+
+static void stream_add_idr_probe(struct stream *st, GstElement *parse) {
+	GstPad *pad = gst_element_get_static_pad(parse, "src");
+	if (pad) {
+		struct idr_probe *ip = g_malloc0(sizeof(struct idr_probe));
+		idr_probe_reset(ip, st);
+		gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, idr_probe_cb,
+			ip, g_free);
+		gst_object_unref(pad);
+		st->idr = ip;
+	}
+}
+
+/* Check if a cached IDR is being held, waiting for a live one */
+static bool stream_is_holding(const struct stream *st) {
+	const struct stream *pr = (st->primary) ? st->primary : st;
+	return pr->idr && g_atomic_int_get(&pr->idr->holding);
+}
+
+/** Check if a cached (stale) frame is shown in place of live video */
+bool stream_is_stale(const struct stream *st) {
+	return stream_is_holding(st);
+}
+
 static void stream_add_h264(struct stream *st) {
-	stream_add(st, stream_create_h264dec(st));
-	stream_add(st, make_element("h264parse", NULL));
+	stream_add_decoder(st, stream_create_h264dec(st));
+	GstElement *parse = make_element("h264parse", NULL);
+	if (parse) {
+		// Put SPS/PPS in every IDR, so cached ones stand alone
+		g_object_set(G_OBJECT(parse), "config-interval", -1, NULL);
+		stream_add_idr_probe(st, parse);
+	}
+	stream_add(st, parse);
 	stream_add(st, make_element("rtph264depay", NULL));
 }
 
+static void stream_add_h265(struct stream *st) {
+	stream_add_decoder(st, stream_create_h265dec(st));
+	GstElement *parse = make_element("h265parse", NULL);
+	if (parse) {
+		// Put VPS/SPS/PPS in every IRAP, for joining mid-stream
+		g_object_set(G_OBJECT(parse), "config-interval", -1, NULL);
+	}
+	stream_add(st, parse);
+	stream_add(st, make_element("rtph265depay", NULL));
+}
+
+static void stream_add_av1(struct stream *st) {
+	stream_add_decoder(st, stream_create_av1dec(st));
+	stream_add(st, make_element("av1parse", NULL));
+	stream_add(st, make_element("rtpav1depay", NULL));
+}
+
 static void stream_add_png(struct stream *st) {
 	stream_add(st, make_element("imagefreeze", NULL));
-	stream_add(st, make_element("videoconvert", NULL));
-	stream_add(st, make_element("pngdec", NULL));
+	stream_add_decoder(st, make_element("pngdec", NULL));
+}
+
+static bool stream_wants_text(const struct stream *st) {
+	return stream_has_description(st);
+}
+
+/** Configure probe mode, for checking stream health without decoding */
+void stream_config_probe(void) {
+	probe_only = true;
+}
+
+static bool stream_is_probe(const struct stream *st) {
+	return probe_only && !stream_has_output(st);
+}
+
+/* Add depayloader and parser only; parsed frames are counted at the sink,
+ * so timeouts, EOS and stalls are still detected */
+static void stream_add_probe_elements(struct stream *st) {
+	stream_add(st, stream_create_probe_sink(st));
+	if (strcmp("H264", st->encoding) == 0) {
+		stream_add(st, make_element("h264parse", NULL));
+		stream_add(st, make_element("rtph264depay", NULL));
+	} else if (strcmp("HEVC", st->encoding) == 0) {
+		stream_add(st, make_element("h265parse", NULL));
+		stream_add(st, make_element("rtph265depay", NULL));
+	} else if (strcmp("AV1", st->encoding) == 0) {
+		stream_add(st, make_element("av1parse", NULL));
+		stream_add(st, make_element("rtpav1depay", NULL));
+	} else if (strcmp("MPEG4", st->encoding) == 0) {
+		stream_add(st, make_element("mpeg4videoparse", NULL));
+		stream_add(st, make_element("rtpmp4vdepay", NULL));
+	} else if (strcmp("PNG", st->encoding) == 0) {
+		/* fetched image is enough */
+	} else if (strcmp("MJPEG", st->encoding) == 0) {
+		stream_add(st, make_element("jpegparse", NULL));
+	} else {
+		stream_add(st, make_element("mpegvideoparse", NULL));
+		stream_add(st, make_element("tsdemux", NULL));
+		stream_add(st, make_element("rtpmp2tdepay", NULL));
+		stream_add_queue(st);
+	}
 }
 
 static void stream_add_later_elements(struct stream *st) {
 	assert(stream_is_encoding_ok(st));
+	if (stream_is_probe(st)) {
+		stream_add_probe_elements(st);
+		return;
+	}
 	stream_add_sink(st);
-	// NOTE: MJPEG and textoverlay don't play well together,
-	//       due to timestamp issues.
-	if (stream_has_description(st) && strcmp("MJPEG", st->encoding) != 0)
+	if (st->low_latency)
+		stream_add_leaky_queue(st);
+	if (stream_wants_text(st))
 		stream_add_text(st);
 	if (stream_has_crop(st))
-		stream_add(st, make_element("videobox", "vbox"));
+		stream_add(st, stream_create_crop(st));
+	if (st->shareable)
+		stream_add_tee(st);
 	if (strcmp("H264", st->encoding) == 0) {
 		stream_add_h264(st);
+	} else if (strcmp("HEVC", st->encoding) == 0) {
+		stream_add_h265(st);
+	} else if (strcmp("AV1", st->encoding) == 0) {
+		stream_add_av1(st);
 	} else if (strcmp("MPEG4", st->encoding) == 0) {
 		stream_add_mpeg4(st);
 	} else if (strcmp("PNG", st->encoding) == 0) {
 		stream_add_png(st);
 	} else if (strcmp("MJPEG", st->encoding) == 0) {
-		stream_add(st, make_element("jpegdec", NULL));
+		stream_add_decoder(st, make_element("jpegdec", NULL));
 	} else {
-		stream_add(st, make_element("mpeg2dec", NULL));
+		stream_add_decoder(st, make_element("mpeg2dec", NULL));
+		if (st->key_only)
+			stream_add(st, make_element("mpegvideoparse", NULL));
 		stream_add(st, make_element("tsdemux", NULL));
 		stream_add(st, make_element("rtpmp2tdepay", NULL));
 		stream_add_queue(st);
@@ -380,6 +1135,46 @@ static void stream_add_udp_pipe(struct stream *st) {
 	stream_add_src_udp(st);
 }
 
+/** Get key for the element chain needed by current parameters.
+ *
+ * Two streams with the same key can share one element chain, with only the
+ * source retargeted. */
+static void stream_chain_key_at(const struct stream *st, const char *loc,
+	char *key, size_t n)
+{
+	/* Full scheme, since it selects the source element */
+	const char *sep = strstr(loc, "://");
+	int scheme = (sep) ? (int) (sep - loc) : (int) strlen(loc);
+	snprintf(key, n, "%s %.*s %d%d%d%d%d%d", st->encoding, scheme, loc,
+		stream_has_description(st), stream_has_crop(st),
+		st->low_latency, st->key_only, stream_is_reduced(st),
+		st->shareable);
+}
+
+static void stream_chain_key(const struct stream *st, char *key, size_t n) {
+	stream_chain_key_at(st, st->location, key, n);
+}
+
+static GstPadProbeReturn input_cb(GstPad *pad, GstPadProbeInfo *info,
+	gpointer user_data)
+{
+	GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+	metrics_add_bytes(user_data, gst_buffer_get_size(buf));
+	return GST_PAD_PROBE_OK;
+}
+
+/* Count input bytes on the element just after the source */
+static void stream_probe_input(struct stream *st) {
+	for (int i = 1; i < MAX_ELEMS; i++) {
+		if (st->elem[i] && st->elem[i] == st->src) {
+			if (st->elem[i - 1])
+				stream_probe_pad(st, st->elem[i - 1], "sink",
+					input_cb);
+			return;
+		}
+	}
+}
+
 static void stream_start_pipeline(struct stream *st) {
 	assert(stream_is_location_ok(st));
 	stream_add_later_elements(st);
@@ -389,32 +1184,154 @@ static void stream_start_pipeline(struct stream *st) {
 		stream_add_src_http(st);
 	else
 		stream_add_src_rtsp(st);
+	stream_probe_input(st);
+	stream_chain_key(st, st->chain, sizeof(st->chain));
 	gst_element_set_state(st->pipeline, GST_STATE_PLAYING);
 }
 
+/** Check if built element chain can be reused for current parameters */
+static bool stream_is_chain_reusable(const struct stream *st) {
+	char key[sizeof(st->chain)];
+	stream_chain_key(st, key, sizeof(key));
+	return (st->src != NULL) && (strcmp(key, st->chain) == 0);
+}
+
+/** Point the built element chain at a new source.
+ *
+ * The pipeline must be in READY state, so all elements are flushed.  Only the
+ * source is taken down to NULL, since udpsrc binds its socket on open. */
+static void stream_retarget_pipeline(struct stream *st) {
+	gst_element_set_state(st->src, GST_STATE_NULL);
+	if (stream_is_udp(st)) {
+		GstCaps *caps = stream_create_caps(st);
+		g_object_set(G_OBJECT(st->src), "uri", st->location, NULL);
+		g_object_set(G_OBJECT(st->fltr), "caps", caps, NULL);
+		gst_caps_unref(caps);
+		g_object_set(G_OBJECT(st->jitter), "latency",
+			stream_jitter_latency(st), NULL);
+	} else if (stream_is_http(st)) {
+		g_object_set(G_OBJECT(st->src), "location",
+			stream_location_http(st), NULL);
+	} else {
+		g_object_set(G_OBJECT(st->src), "location", st->location, NULL);
+		g_object_set(G_OBJECT(st->src), "latency",
+			stream_jitter_latency(st), NULL);
+	}
+	stream_config_text(st);
+	if (st->idr)
+		idr_probe_reset(st->idr, st);
+	stream_update_skip(st);
+	for (int i = 0; i < MAX_ELEMS; i++) {
+		if (st->elem[i])
+			stream_config_quality(st, st->elem[i]);
+	}
+	if (st->sink && has_property(st->sink, "force-aspect-ratio")) {
+		g_object_set(G_OBJECT(st->sink), "force-aspect-ratio",
+			st->aspect, NULL);
+	}
+	if (st->sink) {
+		g_object_set(G_OBJECT(st->sink), "throttle-time",
+			(guint64) 0, NULL);
+	}
+	gst_element_set_state(st->pipeline, GST_STATE_PLAYING);
+}
+
+/** Forget built element chain, so it will not be reused */
+static void stream_drop_chain(struct stream *st) {
+	memset(st->chain, 0, sizeof(st->chain));
+}
+
+/** Forget element chain of a failed stream, which will be restarted */
+static void stream_fail(struct stream *st) {
+	stream_drop_chain(st);
+	st->restarts++;
+}
+
+static GstElement *bin_first_child(GstBin *bin) {
+	GstElement *elem = NULL;
+	GST_OBJECT_LOCK(bin);
+	if (GST_BIN_CHILDREN(bin))
+		elem = gst_object_ref(GST_BIN_CHILDREN(bin)->data);
+	GST_OBJECT_UNLOCK(bin);
+	return elem;
+}
+
+/* Remove elements which are not in the chain (fakesink from a standby swap
+ * which never completed) */
+static void stream_remove_strays(struct stream *st) {
+	GstBin *bin = GST_BIN(st->pipeline);
+	GstElement *elem;
+	while ((elem = bin_first_child(bin))) {
+		gst_element_set_state(elem, GST_STATE_NULL);
+		gst_bin_remove(bin, elem);
+		gst_object_unref(elem);
+	}
+}
+
 static void stream_remove_all(struct stream *st) {
 	GstBin *bin = GST_BIN(st->pipeline);
 	for (int i = 0; i < MAX_ELEMS; i++) {
 		if (st->elem[i])
 			gst_bin_remove(bin, st->elem[i]);
 	}
+	stream_remove_strays(st);
 	memset(st->elem, 0, sizeof(st->elem));
+	stream_drop_chain(st);
+	st->src = NULL;
+	st->fltr = NULL;
+	st->ovl = NULL;
+	st->tee = NULL;
 	st->jitter = NULL;
 	st->sink = NULL;
+	st->idr = NULL;
+	st->skip = NULL;
+	st->converters = 0;
+}
+
+static void stream_unfollow(struct stream *st);
+
+static void stream_do_stop(struct stream *st) {
+	if (st->do_stop)
+		st->do_stop(st);
+}
+
+/* Detach all branches sharing the decoder; their streams are stopped, and
+ * restart on their own */
+static void stream_release_followers(struct stream *st) {
+	while (st->followers) {
+		struct stream *fs = st->followers;
+		stream_unfollow(fs);
+		stream_do_stop(fs);
+	}
 }
 
 static void stream_stop_pipeline(struct stream *st) {
+	if (st->primary)
+		stream_unfollow(st);
+	stream_release_followers(st);
 	gst_element_set_state(st->pipeline, GST_STATE_NULL);
 	stream_remove_all(st);
 }
 
-static void stream_do_stop(struct stream *st) {
-	if (st->do_stop)
-		st->do_stop(st);
+/* Query latency of running pipeline */
+static void stream_query_latency(struct stream *st) {
+	GstQuery *q = gst_query_new_latency();
+	if (gst_element_query(st->pipeline, q)) {
+		gboolean live;
+		GstClockTime min, max;
+		gst_query_parse_latency(q, &live, &min, &max);
+		st->measured = min;
+		if (st->low_latency) {
+			elog_err("Latency %s: %lu ms\n", st->cam_id,
+				min / GST_MSECOND);
+		}
+	}
+	gst_query_unref(q);
 }
 
 static void stream_ack_started(struct stream *st) {
 	lock_acquire(st->lock, __func__);
+	stream_query_latency(st);
 	if (st->ack_started)
 		st->ack_started(st);
 	lock_release(st->lock, __func__);
@@ -423,75 +1340,11 @@ static void stream_ack_started(struct stream *st) {
 static void stream_msg_eos(struct stream *st) {
 	lock_acquire(st->lock, __func__);
 	elog_err("End of stream: %s\n", st->location);
+	stream_fail(st);
 	stream_do_stop(st);
 	lock_release(st->lock, __func__);
 }
 
-static GstElement *stream_find_videobox(struct stream *st) {
-	GstBin *bin = GST_BIN(st->pipeline);
-	return gst_bin_get_by_name(bin, "vbox");
-}
-
-static void stream_config_videobox(struct stream *st, gint width, gint height) {
-	GstElement *vbx = stream_find_videobox(st);
-	if (vbx) {
-		gpointer gobj = G_OBJECT(vbx);
-		g_object_set(gobj, "top", stream_crop_top(st, height), NULL);
-		g_object_set(gobj, "bottom", stream_crop_bottom(st, height),
-			NULL);
-		g_object_set(gobj, "left", stream_crop_left(st, width), NULL);
-		g_object_set(gobj, "right", stream_crop_right(st, width), NULL);
-		gst_object_unref(vbx);
-	}
-}
-
-static void stream_config_size_caps(struct stream *st, GstCaps *caps) {
-	for (int i = 0; i < gst_caps_get_size(caps); i++) {
-		GstStructure *s = gst_caps_get_structure(caps, i);
-		gint height = 0;
-		gint width = 0;
-		gst_structure_get_int(s, "width", &width);
-		gst_structure_get_int(s, "height", &height);
-		if (width > 0 && height > 0)
-			stream_config_videobox(st, width, height);
-	}
-	gst_caps_unref(caps);
-}
-
-static void stream_config_size_pad(struct stream *st, GstPad *pad) {
-	GstCaps *caps = gst_pad_get_current_caps(pad);
-	if (caps)
-		stream_config_size_caps(st, caps);
-	else
-		elog_err("Could not get vbox src pad current caps\n");
-	gst_object_unref(pad);
-}
-
-static void stream_config_size(struct stream *st, GstElement *vbx) {
-	GstPad *pad = gst_element_get_static_pad(vbx, "src");
-	if (pad)
-		stream_config_size_pad(st, pad);
-	else
-		elog_err("Could not find vbox src pad\n");
-	gst_object_unref(vbx);
-}
-
-static void stream_msg_playing(struct stream *st) {
-	GstElement *vbx = stream_find_videobox(st);
-	if (vbx)
-		stream_config_size(st, vbx);
-}
-
-static void stream_msg_state(struct stream *st, GstMessage *msg) {
-	GstState old, state, pending;
-	gst_message_parse_state_changed(msg, &old, &state, &pending);
-	if (GST_STATE_PLAYING == state) {
-		lock_acquire(st->lock, __func__);
-		stream_msg_playing(st);
-		lock_release(st->lock, __func__);
-	}
-}
-
 static void stream_msg_error(struct stream *st, GstMessage *msg) {
 	GError *error;
 	gchar *debug;
@@ -500,6 +1353,7 @@ static void stream_msg_error(struct stream *st, GstMessage *msg) {
 	g_free(debug);
 	lock_acquire(st->lock, __func__);
 	elog_err("Error: %s  %s\n", error->message, st->location);
+	stream_fail(st);
 	stream_do_stop(st);
 	lock_release(st->lock, __func__);
 	g_error_free(error);
@@ -513,6 +1367,7 @@ static void stream_msg_warning(struct stream *st, GstMessage *msg) {
 	g_free(debug);
 	lock_acquire(st->lock, __func__);
 	elog_err("Warning: %s  %s\n", warning->message, st->location);
+	stream_fail(st);
 	stream_do_stop(st);
 	lock_release(st->lock, __func__);
 	g_error_free(warning);
@@ -522,21 +1377,39 @@ static void stream_msg_element(struct stream *st, GstMessage *msg) {
 	if (gst_message_has_name(msg, "GstUDPSrcTimeout")) {
 		elog_err("udpsrc timeout -- stopping stream\n");
 		lock_acquire(st->lock, __func__);
+		stream_fail(st);
 		stream_do_stop(st);
 		lock_release(st->lock, __func__);
 	}
 }
 
+/* QoS is posted by sink or decoder when buffers are dropped, with a running
+ * total per element; count the increase since its last message */
+static void stream_msg_qos(struct stream *st, GstMessage *msg) {
+	GstFormat format;
+	guint64 processed, dropped;
+	GObject *src = G_OBJECT(GST_MESSAGE_SRC(msg));
+	gst_message_parse_qos_stats(msg, &format, &processed, &dropped);
+	if (format == GST_FORMAT_BUFFERS && dropped != (guint64) -1) {
+		guint64 *last = g_object_get_data(src, "qos-dropped");
+		if (!last) {
+			last = g_malloc0(sizeof(guint64));
+			g_object_set_data_full(src, "qos-dropped", last,
+				g_free);
+		}
+		if (dropped > *last)
+			metrics_add_dropped(st->metrics, dropped - *last);
+		*last = dropped;
+	} else
+		metrics_add_dropped(st->metrics, 1);
+}
+
 static gboolean bus_cb(GstBus *bus, GstMessage *msg, gpointer data) {
 	struct stream *st = (struct stream *) data;
 	switch (GST_MESSAGE_TYPE(msg)) {
 	case GST_MESSAGE_EOS:
 		stream_msg_eos(st);
 		break;
-	case GST_MESSAGE_STATE_CHANGED:
-		if (GST_MESSAGE_SRC(msg) == GST_OBJECT(st->pipeline))
-			stream_msg_state(st, msg);
-		break;
 	case GST_MESSAGE_ERROR:
 		stream_msg_error(st, msg);
 		break;
@@ -549,12 +1422,116 @@ static gboolean bus_cb(GstBus *bus, GstMessage *msg, gpointer data) {
 	case GST_MESSAGE_ASYNC_DONE:
 		stream_ack_started(st);
 		break;
+	case GST_MESSAGE_QOS:
+		stream_msg_qos(st, msg);
+		break;
 	default:
 		break;
 	}
 	return TRUE;
 }
 
+static void stream_watch(struct stream *st) {
+	GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(st->pipeline));
+	st->watch = gst_bus_add_watch(bus, bus_cb, st);
+	gst_object_unref(bus);
+}
+
+static void stream_unwatch(struct stream *st) {
+	GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(st->pipeline));
+	gst_bus_remove_watch(bus);
+	gst_object_unref(bus);
+	st->watch = 0;
+}
+
+/* Parse a list of CPUs, such as "0-3,6" */
+static bool parse_cpus(const char **p, uint64_t *mask) {
+	*mask = 0;
+	for (;;) {
+		char *end;
+		long lo = strtol(*p, &end, 10);
+		long hi = lo;
+		if (end == *p || lo < 0 || lo > 63)
+			return false;
+		if (*end == '-') {
+			const char *h = end + 1;
+			hi = strtol(h, &end, 10);
+			if (end == h || hi < lo || hi > 63)
+				return false;
+		}
+		for (long c = lo; c <= hi; c++)
+			*mask |= (uint64_t) 1 << c;
+		*p = end;
+		if (**p != ',')
+			return true;
+		(*p)++;
+	}
+}
+
+/** Configure CPU sets for cells, as "0-3:4-7".
+ *
+ * Each cell's streaming threads are pinned to one set, in turn.
+ * @return true if spec is valid. */
+bool stream_config_affinity(const char *spec) {
+	const char *p = spec;
+	uint32_t n = 0;
+	for (;;) {
+		if (n >= MAX_CPU_SETS || !parse_cpus(&p, cpu_sets + n))
+			return false;
+		n++;
+		if (*p == '\0')
+			break;
+		if (*p != ':')
+			return false;
+		p++;
+	}
+	n_cpu_sets = n;
+	return true;
+}
+
+/* Pin calling thread to the stream's CPU set */
+static void stream_pin_thread(const struct stream *st) {
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	for (int c = 0; c < 64; c++) {
+		if (st->cpus & ((uint64_t) 1 << c))
+			CPU_SET(c, &cpus);
+	}
+	if (sched_setaffinity(0, sizeof(cpu_set_t), &cpus) < 0)
+		elog_err("sched_setaffinity: %s\n", strerror(errno));
+}
+
+/* Bus sync handler, called from the thread which posted the message.
+ * Streaming threads post "enter" when starting, which is the place to pin
+ * them.  Threads created by decoders inherit the affinity. */
+static GstBusSyncReply sync_cb(GstBus *bus, GstMessage *msg, gpointer data) {
+	const struct stream *st = data;
+	if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_STREAM_STATUS) {
+		GstStreamStatusType type;
+		GstElement *owner;
+		gst_message_parse_stream_status(msg, &type, &owner);
+		if (type == GST_STREAM_STATUS_TYPE_ENTER)
+			stream_pin_thread(st);
+	}
+	return GST_BUS_PASS;
+}
+
+/* Bind sync handler of the pipeline bus to the stream.  A handler cannot
+ * be replaced, so any previous one is removed first. */
+static void stream_bind_cpus(struct stream *st) {
+	GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(st->pipeline));
+	gst_bus_set_sync_handler(bus, NULL, NULL, NULL);
+	if (st->cpus)
+		gst_bus_set_sync_handler(bus, sync_cb, st, NULL);
+	gst_object_unref(bus);
+}
+
+/* Set CPU affinity of streaming threads */
+static void stream_set_affinity(struct stream *st, uint32_t idx) {
+	st->cpus = (n_cpu_sets) ? cpu_sets[idx % n_cpu_sets] : 0;
+	stream_bind_cpus(st);
+}
+
 void stream_init(struct stream *st, uint32_t idx, struct lock *lock,
 	nstr_t sink_name)
 {
@@ -566,24 +1543,56 @@ void stream_init(struct stream *st, uint32_t idx, struct lock *lock,
 	nstr_to_cstr(st->sink_name, sizeof(st->sink_name), sink_name);
 	memset(st->crop, 0, sizeof(st->crop));
 	memset(st->cam_id, 0, sizeof(st->cam_id));
+	memset(st->renditions, 0, sizeof(st->renditions));
 	memset(st->location, 0, sizeof(st->location));
 	memset(st->encoding, 0, sizeof(st->encoding));
 	memset(st->sprops, 0, sizeof(st->sprops));
 	memset(st->description, 0, sizeof(st->description));
 	st->latency = DEFAULT_LATENCY;
+	adapt_start(&st->adapt, "", DEFAULT_LATENCY);
 	st->font_sz = 22;
 	st->hgap = 0;
 	st->vgap = 0;
 	st->handle = 0;
+	memset(st->channel, 0, sizeof(st->channel));
 	st->aspect = FALSE;
+	st->low_latency = FALSE;
+	st->key_only = FALSE;
+	st->hidden = FALSE;
+	st->shareable = FALSE;
+	st->degrade = DEGRADE_NONE;
+	st->width = 0;
+	st->height = 0;
+	st->measured = GST_CLOCK_TIME_NONE;
 	st->pipeline = gst_pipeline_new(name);
-	GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(st->pipeline));
-	st->watch = gst_bus_add_watch(bus, bus_cb, st);
-	gst_object_unref(bus);
+	stream_set_affinity(st, idx);
+	stream_watch(st);
 	memset(st->elem, 0, sizeof(st->elem));
+	memset(st->chain, 0, sizeof(st->chain));
+	st->src = NULL;
+	st->fltr = NULL;
+	st->ovl = NULL;
+	st->tee = NULL;
 	st->jitter = NULL;
 	st->sink = NULL;
-	st->last_pts = 0;
+	st->primary = NULL;
+	st->followers = NULL;
+	st->next_follower = NULL;
+	st->tee_pad = NULL;
+	st->idr = NULL;
+	st->skip = NULL;
+	st->converters = 0;
+	memset(st->branch, 0, sizeof(st->branch));
+	st->frames = 0;
+	st->sink_pts = GST_CLOCK_TIME_NONE;
+	st->frames_chk = 0;
+	st->chk_frames = 0;
+	st->chk_drops = 0;
+	st->stalls = 0;
+	st->chk_time = 0;
+	st->fps = 0;
+	st->metrics = metrics_create();
+	st->restarts = 0;
 	st->pushed = 0;
 	st->lost = 0;
 	st->late = 0;
@@ -595,6 +1604,8 @@ void stream_destroy(struct stream *st) {
 	stream_stop_pipeline(st);
 	gst_object_unref(st->pipeline);
 	g_source_remove(st->watch);
+	metrics_destroy(st->metrics);
+	st->metrics = NULL;
 	st->pipeline = NULL;
 	st->lock = NULL;
 }
@@ -603,71 +1614,345 @@ void stream_set_handle(struct stream *st, guintptr handle) {
 	st->handle = handle;
 }
 
+/** Send output to an intervideo channel instead of a window */
+void stream_set_channel(struct stream *st, const char *channel) {
+	snprintf(st->channel, sizeof(st->channel), "%s", channel);
+}
+
+/** Decode keyframes only (for next start) */
+void stream_set_key_only(struct stream *st, bool key_only) {
+	st->key_only = key_only;
+}
+
+/** Set hidden state.  While hidden, the source keeps receiving but nothing is
+ * decoded; when shown again, decoding resumes at the next keyframe. */
+void stream_set_hidden(struct stream *st, bool hidden) {
+	if (st->hidden != hidden) {
+		st->hidden = hidden;
+		st->stalls = 0;
+		stream_update_skip(st);
+	}
+}
+
+/** Set degrade level, applied to the running pipeline */
+void stream_set_degrade(struct stream *st, enum degrade level) {
+	enum degrade prev = st->degrade;
+	if (level == prev)
+		return;
+	st->degrade = level;
+	if (st->sink) {
+		g_object_set(G_OBJECT(st->sink), "throttle-time",
+			(level >= DEGRADE_RATE)
+			? (guint64) DEGRADE_THROTTLE_NS
+			: (guint64) 0, NULL);
+	}
+	/* The pipeline keeps playing, so the jitterbuffer does not stall */
+	stream_update_skip(st);
+}
+
+/** Set size of video area, to choose decoding quality (for next start).
+ *
+ * @return true if decoding quality has changed. */
+bool stream_set_size(struct stream *st, gint width, gint height) {
+	bool reduced = stream_is_reduced(st);
+	st->width = width;
+	st->height = height;
+	stream_config_text(st);
+	return reduced != stream_is_reduced(st);
+}
+
 void stream_set_aspect(struct stream *st, bool aspect) {
 	st->aspect = aspect;
 }
 
+/** Add a tee so other streams can share the decoder (for next start) */
+void stream_set_shareable(struct stream *st, bool share) {
+	st->shareable = share;
+}
+
+/** Select low-latency profile (for next start) */
+void stream_set_low_latency(struct stream *st, bool low) {
+	st->low_latency = low;
+}
+
 void stream_set_params(struct stream *st, nstr_t cam_id, nstr_t loc,
 	nstr_t desc, nstr_t encoding, uint32_t latency, nstr_t sprops)
 {
 	nstr_to_cstr(st->cam_id, sizeof(st->cam_id), cam_id);
-	nstr_to_cstr(st->location, sizeof(st->location), loc);
+	nstr_to_cstr(st->renditions, sizeof(st->renditions), loc);
 	nstr_to_cstr(st->description, sizeof(st->description), desc);
 	nstr_to_cstr(st->encoding, sizeof(st->encoding), encoding);
 	st->latency = latency;
 	nstr_to_cstr(st->sprops, sizeof(st->sprops), sprops);
+	stream_select_rendition(st, false);
+}
+
+/* Check if a rendition fills the video area, without scaling up */
+static bool stream_is_filled(const struct stream *st, unsigned w, unsigned h) {
+	if (st->width <= 0 || st->height <= 0)
+		return true;
+	/* With aspect ratio kept, only one dimension must fill */
+	bool fw = w >= (unsigned) st->width;
+	bool fh = h >= (unsigned) st->height;
+	return (st->aspect) ? (fw || fh) : (fw && fh);
+}
+
+/** Select a location from the requested renditions.
+ *
+ * Renditions are separated by spaces, smallest first, each as "WxH=URI".
+ * The first one which fills the video area is selected, or the last one for
+ * full resolution.  A rendition without a size never fills the area.
+ *
+ * @param full Select full resolution (selected or full-screen cell).
+ * @return true if the selected location changed. */
+bool stream_select_rendition(struct stream *st, bool full) {
+	char buf[sizeof(st->renditions)];
+	char loc[sizeof(st->location)];
+	char *save = NULL;
+
+	loc[0] = '\0';
+	memcpy(buf, st->renditions, sizeof(buf));
+	for (char *tok = strtok_r(buf, " ", &save); tok;
+	     tok = strtok_r(NULL, " ", &save))
+	{
+		unsigned w = 0, h = 0;
+		int n = 0;
+		sscanf(tok, "%ux%u=%n", &w, &h, &n);
+		snprintf(loc, sizeof(loc), "%s", tok + n);
+		if (!full && n > 0 && stream_is_filled(st, w, h))
+			break;
+	}
+	if (strcmp(loc, st->location) != 0) {
+		memcpy(st->location, loc, sizeof(loc));
+		return true;
+	}
+	return false;
 }
 
 void stream_set_font_size(struct stream *st, uint32_t sz) {
 	st->font_sz = sz;
 }
 
-/* Check sink to make sure that last-sample is updating.
+/* Check if delta units are skipped until the next keyframe (after unhide) */
+static bool stream_is_resuming(const struct stream *st) {
+	return st->skip && g_atomic_int_get(st->skip) == SKIP_RESUME;
+}
+
+/* Get number of sink checks without frames before a stream is stuck.
+ * While skipping delta units (configured, degraded or resuming), frames only
+ * arrive once per GOP. */
+static gint stream_stall_checks(const struct stream *st) {
+	return (stream_is_skipping(st) || stream_is_resuming(st))
+	      ? KEY_ONLY_STALL_CHECKS
+	      : 1;
+}
+
+/* Check sink frame counter to make sure that frames are flowing.
  * If not, post an EOS message on the bus. */
-static void stream_check_sink(struct stream *st) {
-	GstSample *s;
-	g_object_get(st->sink, "last-sample", &s, NULL);
-	if (s) {
-		GstBuffer *b = gst_sample_get_buffer(s);
-		GstClockTime t = GST_BUFFER_PTS(b);
-		gst_sample_unref(s);
-		if (t == st->last_pts) {
-			elog_err("PTS stuck at %lu; posting EOS\n", t);
-			GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(
-			                                   st->pipeline));
-			gst_bus_post(bus, gst_message_new_eos(
-			             GST_OBJECT_CAST(st->sink)));
-			gst_object_unref(bus);
+static void stream_check_sink(struct stream *st, gint frames) {
+	if (frames > 0 && frames == st->frames_chk)
+		st->stalls++;
+	else
+		st->stalls = 0;
+	if (st->stalls >= stream_stall_checks(st)) {
+		GstClockTime t = __atomic_load_n(&st->sink_pts,
+			__ATOMIC_RELAXED);
+		elog_err("PTS stuck at %lu; posting EOS\n", t);
+		GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(st->pipeline));
+		gst_bus_post(bus, gst_message_new_eos(GST_OBJECT_CAST(
+			st->sink)));
+		gst_object_unref(bus);
+	}
+}
+
+/* Sample frame rate and interval metrics */
+static void stream_sample(struct stream *st, gint frames) {
+	gint64 now = g_get_monotonic_time();
+	if (st->chk_time && now > st->chk_time) {
+		double secs = (double) (now - st->chk_time) / G_USEC_PER_SEC;
+		st->chk_frames = frames - st->frames_chk;
+		st->fps = st->chk_frames / secs;
+		st->chk_drops = metrics_sample(st->metrics, secs, st->fps);
+	}
+	st->frames_chk = frames;
+	st->chk_time = now;
+}
+
+/* Scale a size to fit a frame, keeping its aspect ratio */
+static void fit_sample(GstSample *s, gint *width, gint *height) {
+	GstVideoInfo info;
+	GstCaps *caps = gst_sample_get_caps(s);
+	if (caps && gst_video_info_from_caps(&info, caps)) {
+		gint vw = GST_VIDEO_INFO_WIDTH(&info);
+		gint vh = GST_VIDEO_INFO_HEIGHT(&info);
+		if (vw > 0 && vh > 0) {
+			if (*width * vh > *height * vw)
+				*width = MAX(*height * vw / vh, 1);
+			else
+				*height = MAX(*width * vh / vw, 1);
 		}
-		st->last_pts = t;
 	}
 }
 
-void stream_check_eos(struct stream *st) {
+/** Get the last rendered frame.
+ *
+ * The sink already holds the last buffer, so this only takes a reference.
+ *
+ * @return Sample, or NULL. */
+GstSample *stream_last_sample(struct stream *st) {
+	GstSample *s = NULL;
 	if (st->sink)
-		stream_check_sink(st);
+		g_object_get(st->sink, "last-sample", &s, NULL);
+	return s;
 }
 
-static bool stream_jitter_stats(struct stream *st) {
+/** Convert a sample to a snapshot, scaled to fit a size.
+ *
+ * This builds a conversion pipeline, so it must not run on the main loop.
+ *
+ * @return BGRx sample, or NULL. */
+GstSample *stream_snapshot(GstSample *s, bool aspect, gint width, gint height)
+{
+	GError *err = NULL;
+	if (width <= 0 || height <= 0)
+		return NULL;
+	if (aspect)
+		fit_sample(s, &width, &height);
+	GstCaps *caps = gst_caps_new_simple("video/x-raw",
+		"format", G_TYPE_STRING, "BGRx",
+		"width", G_TYPE_INT, width,
+		"height", G_TYPE_INT, height,
+		"pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
+		NULL);
+	GstSample *snap = gst_video_convert_sample(s, caps, GST_SECOND / 4,
+		&err);
+	if (err) {
+		elog_err("Snapshot error: %s\n", err->message);
+		g_error_free(err);
+	}
+	gst_caps_unref(caps);
+	return snap;
+}
+
+/* Get cumulative packet counts from jitterbuffer */
+static bool stream_jitter_counts(struct stream *st, guint64 *pushed,
+	guint64 *lost, guint64 *late)
+{
 	GstStructure *s;
+	if (!st->jitter)
+		return false;
 	g_object_get(st->jitter, "stats", &s, NULL);
 	if (s) {
-		guint64 pushed, lost, late;
 		gboolean r =
-			gst_structure_get_uint64(s, "num-pushed", &pushed)
-		     && gst_structure_get_uint64(s, "num-lost", &lost)
-		     && gst_structure_get_uint64(s, "num-late", &late);
+			gst_structure_get_uint64(s, "num-pushed", pushed)
+		     && gst_structure_get_uint64(s, "num-lost", lost)
+		     && gst_structure_get_uint64(s, "num-late", late);
 		gst_structure_free(s);
-		if (r) {
-			st->pushed = pushed;
-			st->lost = lost;
-			st->late = late;
-			return true;
+		return r;
+	}
+	return false;
+}
+
+/* Get network jitter estimate (ms).  The jitterbuffer sees packet arrival,
+ * so use its estimate when there is one. */
+static double stream_network_jitter(struct stream *st) {
+	GstStructure *s = NULL;
+	guint64 avg = 0;
+	if (st->jitter)
+		g_object_get(st->jitter, "stats", &s, NULL);
+	if (s) {
+		gboolean r = gst_structure_get_uint64(s, "avg-jitter", &avg);
+		gst_structure_free(s);
+		if (r)
+			return (double) avg / GST_MSECOND;
+	}
+	return metrics_jitter(st->metrics);
+}
+
+/* Adapt jitterbuffer latency to network conditions.  Without a separate
+ * jitterbuffer (RTSP), learned latency is used on the next start. */
+static void stream_adapt_latency(struct stream *st) {
+	guint64 pushed = 0, lost = 0, late = 0;
+	stream_jitter_counts(st, &pushed, &lost, &late);
+	if (adapt_update(&st->adapt, stream_network_jitter(st), lost, late)) {
+		elog_err("Jitterbuffer %s: %u ms\n", st->cam_id,
+			st->adapt.latency);
+		if (st->jitter) {
+			g_object_set(G_OBJECT(st->jitter), "latency",
+				st->adapt.latency, NULL);
 		}
 	}
+}
+
+/** Check sink frames, sample metrics and adapt latency.
+ *
+ * Called on the main loop without the stream lock: the pipeline only changes
+ * on that thread, and frame counters are atomic. */
+void stream_check_eos(struct stream *st) {
+	if (st->sink) {
+		gint frames = g_atomic_int_get(&st->frames);
+		if (!stream_is_holding(st) && st->degrade < DEGRADE_PAUSE &&
+		    !st->hidden)
+			stream_check_sink(st, frames);
+		stream_sample(st, frames);
+		if (!st->low_latency && !st->primary)
+			stream_adapt_latency(st);
+	}
+}
+
+static bool stream_jitter_stats(struct stream *st) {
+	guint64 pushed, lost, late;
+	if (stream_jitter_counts(st, &pushed, &lost, &late)) {
+		st->pushed = pushed;
+		st->lost = lost;
+		st->late = late;
+		return true;
+	}
 	return false;
 }
 
+/* Get measured pipeline latency (ms) */
+static double stream_latency_ms(const struct stream *st) {
+	return GST_CLOCK_TIME_IS_VALID(st->measured)
+	      ? (double) st->measured / GST_MSECOND
+	      : 0;
+}
+
+/** Get current pipeline state name (without waiting) */
+const char *stream_state(struct stream *st) {
+	GstState state = GST_STATE_VOID_PENDING;
+	gst_element_get_state(st->pipeline, &state, NULL, 0);
+	return gst_element_state_get_name(state);
+}
+
+/** Format metrics of a stream as a JSON object */
+int stream_metrics_json(struct stream *st, char *buf, size_t n) {
+	guint64 pushed = 0, lost = 0, late = 0;
+	stream_jitter_counts(st, &pushed, &lost, &late);
+	int len = snprintf(buf, n, "{\"state\":\"%s\",", stream_state(st));
+	size_t off = MIN((size_t) len, n);
+	len += metrics_format_json(st->metrics, buf + off, n - off);
+	off = MIN((size_t) len, n);
+	return len + snprintf(buf + off, n - off, "\"restarts\":%u,"
+		"\"low_latency\":%s,\"latency_ms\":%.1f,"
+		"\"jitterbuffer_ms\":%u,\"degrade\":%d,\"converters\":%u,"
+		"\"pushed\":%" G_GUINT64_FORMAT ",\"lost\":%" G_GUINT64_FORMAT
+		",\"late\":%" G_GUINT64_FORMAT "}", st->restarts,
+		(st->low_latency) ? "true" : "false", stream_latency_ms(st),
+		stream_jitter_latency(st), st->degrade, st->converters, pushed,
+		lost, late);
+}
+
+/** Format metrics of a stream as text */
+int stream_metrics(struct stream *st, char *buf, size_t n) {
+	int len = metrics_format(st->metrics, buf, n);
+	size_t off = MIN((size_t) len, n);
+	return len + snprintf(buf + off, n - off, "restarts %u latency_ms %.1f "
+		"jitterbuffer_ms %u degrade %d converters %u", st->restarts,
+		stream_latency_ms(st), stream_jitter_latency(st), st->degrade,
+		st->converters);
+}
+
 static bool stream_update_stats(struct stream *st) {
 	return (st->jitter) && stream_jitter_stats(st);
 }
@@ -681,20 +1966,35 @@ bool stream_stats(struct stream *st) {
 	guint64 lost = st->lost;
 	guint64 late = st->late;
 	bool update = stream_update_stats(st);
+	if (st->sink) {
+		char buf[256];
+		stream_metrics(st, buf, sizeof(buf));
+		elog_err("metrics %s: %s\n", st->cam_id, buf);
+	}
 	if (update) {
 		elog_err("stats %s: "
 			 "%" G_GUINT64_FORMAT " pushed, "
 			 "%" G_GUINT64_FORMAT " lost, "
-			 "%" G_GUINT64_FORMAT " late pkts\n", st->cam_id,
+			 "%" G_GUINT64_FORMAT " late pkts, "
+			 "%.1f fps\n", st->cam_id,
 		         pkt_count(pushed, st->pushed),
 		         pkt_count(lost, st->lost),
-		         pkt_count(late, st->late));
+		         pkt_count(late, st->late), st->fps);
 		return true;
 	} else
 		return false;
 }
 
 static void stream_reset_counters(struct stream *st) {
+	g_atomic_int_set(&st->frames, 0);
+	st->sink_pts = GST_CLOCK_TIME_NONE;
+	st->frames_chk = 0;
+	st->chk_frames = 0;
+	st->chk_drops = 0;
+	st->stalls = 0;
+	st->chk_time = 0;
+	st->fps = 0;
+	metrics_reset(st->metrics);
 	st->pushed = 0;
 	st->lost = 0;
 	st->late = 0;
@@ -706,20 +2006,310 @@ static void stream_start_pipe(struct stream *st) {
 }
 
 bool stream_start(struct stream *st) {
-	/* Make sure pipeline is not running */
-	stream_stop_pipeline(st);
+	adapt_start(&st->adapt, st->cam_id, st->latency);
+	st->degrade = DEGRADE_NONE;
 	if (!stream_is_location_ok(st)) {
 		elog_err("Invalid location: %s\n", st->location);
+		stream_stop_pipeline(st);
 		return false;
 	}
 	if (!stream_is_encoding_ok(st)) {
 		elog_err("Invalid encoding: %s\n", st->encoding);
+		stream_stop_pipeline(st);
 		return false;
 	}
+	if (stream_is_chain_reusable(st)) {
+		stream_reset_counters(st);
+		stream_retarget_pipeline(st);
+		return true;
+	}
+	/* Make sure pipeline is not running */
+	stream_stop_pipeline(st);
 	stream_start_pipe(st);
 	return true;
 }
 
+/* Stop the stream.  After a clean stop, the element chain is kept in READY
+ * state, so that it can be reused by the next start. */
 void stream_stop(struct stream *st) {
+	st->degrade = DEGRADE_NONE;
+	stream_release_followers(st);
+	if (st->chain[0] && !st->primary) {
+		gst_element_set_state(st->pipeline, GST_STATE_READY);
+		/* Release udpsrc socket (and multicast membership) */
+		gst_element_set_state(st->src, GST_STATE_NULL);
+	} else
+		stream_stop_pipeline(st);
+}
+
+/** Stop the stream and tear down its pipeline, without keeping the chain */
+void stream_teardown(struct stream *st) {
+	st->degrade = DEGRADE_NONE;
 	stream_stop_pipeline(st);
 }
+
+/** Check if two streams were started with the same source parameters */
+static bool stream_is_same_source(const struct stream *st,
+	const struct stream *sb)
+{
+	char key[sizeof(st->chain)];
+	stream_chain_key(st, key, sizeof(key));
+	return (sb->src != NULL)
+	    && (strcmp(st->location, sb->location) == 0)
+	    && (strcmp(st->encoding, sb->encoding) == 0)
+	    && (strcmp(st->sprops, sb->sprops) == 0)
+	    && (strcmp(key, sb->chain) == 0);
+}
+
+/** Swap running pipelines between two streams */
+static void stream_swap_pipeline(struct stream *st, struct stream *sb) {
+	GstElement *elem[MAX_ELEMS];
+	char chain[sizeof(st->chain)];
+
+	stream_unwatch(st);
+	stream_unwatch(sb);
+	GstElement *pipeline = st->pipeline;
+	st->pipeline = sb->pipeline;
+	sb->pipeline = pipeline;
+	memcpy(elem, st->elem, sizeof(elem));
+	memcpy(st->elem, sb->elem, sizeof(elem));
+	memcpy(sb->elem, elem, sizeof(elem));
+	memcpy(chain, st->chain, sizeof(chain));
+	memcpy(st->chain, sb->chain, sizeof(chain));
+	memcpy(sb->chain, chain, sizeof(chain));
+	GstElement *src = st->src;
+	st->src = sb->src;
+	sb->src = src;
+	GstElement *fltr = st->fltr;
+	st->fltr = sb->fltr;
+	sb->fltr = fltr;
+	struct overlay *ovl = st->ovl;
+	st->ovl = sb->ovl;
+	sb->ovl = ovl;
+	GstElement *tee = st->tee;
+	st->tee = sb->tee;
+	sb->tee = tee;
+	GstElement *jitter = st->jitter;
+	st->jitter = sb->jitter;
+	sb->jitter = jitter;
+	GstElement *sink = st->sink;
+	st->sink = sb->sink;
+	sb->sink = sink;
+	struct idr_probe *idr = st->idr;
+	st->idr = sb->idr;
+	sb->idr = idr;
+	gint *skip = st->skip;
+	st->skip = sb->skip;
+	sb->skip = skip;
+	uint32_t converters = st->converters;
+	st->converters = sb->converters;
+	sb->converters = converters;
+	enum degrade degrade = st->degrade;
+	st->degrade = sb->degrade;
+	sb->degrade = degrade;
+	struct metrics *metrics = st->metrics;
+	st->metrics = sb->metrics;
+	sb->metrics = metrics;
+	GstClockTime measured = st->measured;
+	st->measured = sb->measured;
+	sb->measured = measured;
+	struct adapt adapt = st->adapt;
+	st->adapt = sb->adapt;
+	sb->adapt = adapt;
+	stream_reset_counters(st);
+	stream_reset_counters(sb);
+	stream_watch(st);
+	stream_watch(sb);
+	/* Threads started after this are pinned for the stream owning them */
+	stream_bind_cpus(st);
+	stream_bind_cpus(sb);
+}
+
+/* Sink swap which happens in a blocked streaming thread */
+struct sink_swap {
+	GstElement	*pipeline;
+	GstElement	*old;
+	GstElement	*sink;
+};
+
+static void sink_swap_free(gpointer data) {
+	struct sink_swap *ss = data;
+	gst_object_unref(ss->pipeline);
+	gst_object_unref(ss->old);
+	gst_object_unref(ss->sink);
+	g_free(ss);
+}
+
+static GstPadProbeReturn swap_sink_cb(GstPad *pad, GstPadProbeInfo *info,
+	gpointer data)
+{
+	struct sink_swap *ss = data;
+	GstElement *up = gst_pad_get_parent_element(pad);
+	if (up) {
+		gst_element_unlink(up, ss->old);
+		gst_element_set_state(ss->old, GST_STATE_NULL);
+		gst_bin_remove(GST_BIN(ss->pipeline), ss->old);
+		if (!gst_element_link(up, ss->sink))
+			elog_err("Standby sink link failed\n");
+		gst_element_sync_state_with_parent(ss->sink);
+		gst_object_unref(up);
+	}
+	return GST_PAD_PROBE_REMOVE;
+}
+
+/** Replace the fakesink of a standby chain with a real sink */
+static void stream_attach_sink(struct stream *st) {
+	if (!stream_has_output(st))
+		return;
+	GstElement *old = st->elem[0];
+	GstPad *pad = gst_element_get_static_pad(st->elem[1], "src");
+	if (!pad) {
+		elog_err("Standby src pad not found\n");
+		return;
+	}
+	GstElement *sink = stream_create_sink(st);
+	if (sink && gst_bin_add(GST_BIN(st->pipeline), sink)) {
+		struct sink_swap *ss = g_malloc0(sizeof(struct sink_swap));
+		ss->pipeline = gst_object_ref(st->pipeline);
+		ss->old = gst_object_ref(old);
+		ss->sink = gst_object_ref(sink);
+		st->elem[0] = sink;
+		gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
+			swap_sink_cb, ss, sink_swap_free);
+	}
+	gst_object_unref(pad);
+}
+
+/* Tear down pipeline, and take over the running pipeline of another stream */
+static void stream_take_pipeline(struct stream *st, struct stream *sb) {
+	stream_stop_pipeline(st);
+	stream_swap_pipeline(st, sb);
+	stream_attach_sink(st);
+	stream_update_skip(st);
+}
+
+/** Take over the running pipeline of a standby stream.
+ *
+ * The standby stream must have been started with the same parameters, and
+ * without any output (fakesink).  The current pipeline is torn down,
+ * and the standby's fakesink is replaced by a real sink as soon as the next
+ * decoded buffer arrives, so no keyframe wait is needed.
+ *
+ * @return true if pipelines were swapped. */
+bool stream_swap_standby(struct stream *st, struct stream *sb) {
+	if (!stream_is_same_source(st, sb) || stream_has_output(sb) ||
+	    !sb->elem[1])
+		return false;
+	stream_take_pipeline(st, sb);
+	return true;
+}
+
+/** Take over the running pipeline of a stream racing from another location.
+ *
+ * The racer must have been started with the same parameters, except for
+ * location and sprops, and without any output.  The stream keeps its own
+ * location, so that a restart races again from the same locations.
+ *
+ * @return true if pipelines were swapped. */
+bool stream_swap_racer(struct stream *st, struct stream *rc) {
+	char key[sizeof(st->chain)];
+	stream_chain_key_at(st, rc->location, key, sizeof(key));
+	if (rc->src == NULL || strcmp(key, rc->chain) != 0 ||
+	    stream_has_output(rc) || !rc->elem[1])
+		return false;
+	stream_take_pipeline(st, rc);
+	return true;
+}
+
+/** Check if a stream can be displayed from the decoder of another, if that
+ * one has a tee */
+bool stream_is_same_feed(const struct stream *st, const struct stream *pr) {
+	return (strcmp(st->location, pr->location) == 0)
+	    && (strcmp(st->encoding, pr->encoding) == 0)
+	    && (strcmp(st->sprops, pr->sprops) == 0)
+	    && (st->low_latency == pr->low_latency)
+	    && (st->key_only == pr->key_only)
+	    && (stream_is_reduced(st) || !stream_is_reduced(pr));
+}
+
+/** Check if a stream can share the decoder of another (primary) stream */
+bool stream_can_share(const struct stream *st, const struct stream *pr) {
+	return (pr->tee != NULL)
+	    && (pr->chain[0] != '\0')
+	    && stream_is_same_feed(st, pr);
+}
+
+static void stream_add_branch(struct stream *st, GstElement *elem) {
+	GstBin *bin = GST_BIN(st->primary->pipeline);
+	if (elem != NULL && gst_bin_add(bin, elem)) {
+		int i = 0;
+		while (i < MAX_BRANCH - 1 && st->branch[i])
+			i++;
+		st->branch[i] = elem;
+		if (i > 0 && !gst_element_link(st->branch[i - 1], elem))
+			elog_err("Branch link error\n");
+	} else
+		elog_err("Element not added to branch\n");
+}
+
+/** Detach a branch from the tee of its primary stream */
+static void stream_unfollow(struct stream *st) {
+	GstBin *bin = GST_BIN(st->primary->pipeline);
+	struct stream **fp = &st->primary->followers;
+	while (*fp && *fp != st)
+		fp = &(*fp)->next_follower;
+	if (*fp)
+		*fp = st->next_follower;
+	st->next_follower = NULL;
+	if (st->tee_pad) {
+		gst_element_release_request_pad(st->primary->tee, st->tee_pad);
+		gst_object_unref(st->tee_pad);
+		st->tee_pad = NULL;
+	}
+	for (int i = 0; i < MAX_BRANCH; i++) {
+		if (st->branch[i]) {
+			gst_element_set_state(st->branch[i], GST_STATE_NULL);
+			gst_bin_remove(bin, st->branch[i]);
+		}
+	}
+	memset(st->branch, 0, sizeof(st->branch));
+	st->primary = NULL;
+	st->ovl = NULL;
+	st->sink = NULL;
+}
+
+/** Display a stream by sharing the decoder of another (primary) stream.
+ *
+ * A branch with queue, videocrop, overlay and sink elements is added to
+ * the primary pipeline, fed from its tee.  The pipeline of this stream is
+ * left empty. */
+bool stream_follow(struct stream *st, struct stream *pr) {
+	stream_stop_pipeline(st);
+	stream_reset_counters(st);
+	st->primary = pr;
+	stream_add_branch(st, make_element("queue", NULL));
+	if (stream_has_crop(st))
+		stream_add_branch(st, stream_create_crop(st));
+	if (stream_wants_text(st))
+		stream_add_branch(st, stream_create_text(st));
+	stream_add_branch(st, stream_create_sink(st));
+	GstPad *sink_pad = gst_element_get_static_pad(st->branch[0], "sink");
+	st->tee_pad = gst_element_request_pad_simple(pr->tee, "src_%u");
+	if (!sink_pad || !st->tee_pad ||
+	    gst_pad_link(st->tee_pad, sink_pad) != GST_PAD_LINK_OK)
+	{
+		elog_err("Could not link branch to tee\n");
+		if (sink_pad)
+			gst_object_unref(sink_pad);
+		stream_unfollow(st);
+		return false;
+	}
+	gst_object_unref(sink_pad);
+	st->next_follower = pr->followers;
+	pr->followers = st;
+	for (int i = MAX_BRANCH - 1; i >= 0; i--) {
+		if (st->branch[i])
+			gst_element_sync_state_with_parent(st->branch[i]);
+	}
+	return true;
+}
@@ -4,31 +4,78 @@
 #include <stdint.h>
 #include <string.h>
 #include <gst/gst.h>
+#include "adapt.h"
 #include "lock.h"
+#include "metrics.h"
+#include "overlay.h"
 
 #define MAX_ELEMS	(16)
+#define MAX_BRANCH	(4)
+
+/* Degrade levels, set by CPU governor */
+enum degrade {
+	DEGRADE_NONE,           /* full quality */
+	DEGRADE_RATE,           /* frame rate capped */
+	DEGRADE_KEY_ONLY,       /* keyframes only */
+	DEGRADE_PAUSE,          /* nothing decoded */
+	DEGRADE_LEVELS,
+};
 
 struct stream {
 	struct lock	*lock;
 	guintptr	handle;
 	gboolean	aspect;
-	char		sink_name[8];
+	gboolean	low_latency;     /* low-latency profile */
+	gboolean	key_only;        /* decode keyframes only */
+	gboolean	hidden;          /* not visible; nothing decoded */
+	gboolean	shareable;       /* tee for other streams to share */
+	enum degrade	degrade;         /* governor degrade level */
+	char		sink_name[12];
+	char		channel[8];      /* intervideo channel (compositor) */
 	char		crop[6];         /* crop code */
 	char		cam_id[20];      /* camera ID */
-	char		location[128];
+	char		renditions[256]; /* requested location(s) */
+	char		location[128];   /* selected location */
 	char		description[64]; /* text overlay */
 	char		encoding[8];
-	char		sprops[64];
-	uint32_t	latency;
+	char		sprops[160];
+	uint32_t	latency;         /* requested latency */
+	struct adapt	adapt;           /* adaptive jitterbuffer latency */
 	uint32_t	font_sz;
 	uint32_t	hgap;
 	uint32_t	vgap;
+	gint		width;           /* size of video area */
+	gint		height;
+	uint64_t	cpus;            /* CPU affinity mask (0 for any) */
 	GstElement	*pipeline;
 	guint           watch;
 	GstElement	*elem[MAX_ELEMS];
+	char		chain[24];       /* key of built element chain */
+	GstElement	*src;
+	GstElement	*fltr;
+	struct overlay	*ovl;            /* description overlay (probe owned) */
+	GstElement	*tee;
 	GstElement	*jitter;
 	GstElement	*sink;
-	GstClockTime	last_pts;
+	struct stream	*primary;        /* stream sharing its decoder */
+	GstPad		*tee_pad;        /* request pad on primary tee */
+	GstElement	*branch[MAX_BRANCH];
+	struct stream	*followers;      /* first stream sharing decoder */
+	struct stream	*next_follower;  /* next stream sharing primary */
+	struct idr_probe *idr;           /* keyframe cache probe (H264) */
+	gint		*skip;           /* drop delta units (atomic, probe) */
+	gint		frames;          /* frames to sink (atomic) */
+	GstClockTime	sink_pts;        /* PTS of last frame (atomic) */
+	gint		frames_chk;      /* frames at last check */
+	gint		stalls;          /* checks without new frames */
+	gint64		chk_time;        /* time of last check (us) */
+	double		fps;             /* frame rate at last check */
+	gint		chk_frames;      /* frames in last check interval */
+	uint32_t	chk_drops;       /* drops in last check interval */
+	struct metrics	*metrics;        /* metrics of running pipeline */
+	uint32_t	restarts;        /* restarts after failure */
+	uint32_t	converters;      /* format converters in pipeline */
+	GstClockTime	measured;        /* latency from query */
 	guint64		pushed;
 	guint64		lost;
 	guint64		late;
@@ -36,19 +83,42 @@ struct stream {
 	void		(*ack_started)	(struct stream *st);
 };
 
+bool stream_config_threads(const char *spec);
+bool stream_config_affinity(const char *spec);
+void stream_config_probe(void);
 void stream_init(struct stream *st, uint32_t idx, struct lock *lock,
 	nstr_t sink_name);
 void stream_destroy(struct stream *st);
 void stream_set_handle(struct stream *st, guintptr handle);
+void stream_set_channel(struct stream *st, const char *channel);
+void stream_set_key_only(struct stream *st, bool key_only);
+void stream_set_hidden(struct stream *st, bool hidden);
+void stream_set_degrade(struct stream *st, enum degrade level);
+bool stream_set_size(struct stream *st, gint width, gint height);
 void stream_set_aspect(struct stream *st, bool aspect);
+void stream_set_shareable(struct stream *st, bool share);
+void stream_set_low_latency(struct stream *st, bool low);
 void stream_set_font_size(struct stream *st, uint32_t sz);
 void stream_set_crop(struct stream *st, nstr_t crop, uint32_t hgap,
 	uint32_t vgap);
 void stream_set_params(struct stream *st, nstr_t cam_id, nstr_t loc,
 	nstr_t desc, nstr_t encoding, uint32_t latency, nstr_t sprops);
+bool stream_select_rendition(struct stream *st, bool full);
 bool stream_stats(struct stream *st);
+bool stream_is_stale(const struct stream *st);
 bool stream_start(struct stream *st);
 void stream_stop(struct stream *st);
+void stream_teardown(struct stream *st);
 void stream_check_eos(struct stream *st);
+const char *stream_state(struct stream *st);
+int stream_metrics(struct stream *st, char *buf, size_t n);
+int stream_metrics_json(struct stream *st, char *buf, size_t n);
+GstSample *stream_last_sample(struct stream *st);
+GstSample *stream_snapshot(GstSample *s, bool aspect, gint width, gint height);
+bool stream_swap_standby(struct stream *st, struct stream *sb);
+bool stream_swap_racer(struct stream *st, struct stream *rc);
+bool stream_is_same_feed(const struct stream *st, const struct stream *pr);
+bool stream_can_share(const struct stream *st, const struct stream *pr);
+bool stream_follow(struct stream *st, struct stream *pr);
 
 #endif